@@ -0,0 +1,29 @@
+#pragma once
+#include <chrono>
+
+// Benchmarks of the hot paths, built with 'make bench' into rvmbench. Each benchmark is run
+// with the arguments that follow its name on the command line, generates its own data and
+// prints a table to stdout.
+
+int benchInterning(int argc, char** argv);
+int benchParseAtt(int argc, char** argv);
+int benchParseRVM(int argc, char** argv);
+int benchTessellation(int argc, char** argv);
+
+// Logger that drops info messages and prints warnings and errors.
+void benchLogger(unsigned level, const char* msg, ...);
+
+// Runs f repeat times and returns the fastest run in seconds.
+template<typename F>
+double bestOf(unsigned repeat, F f)
+{
+  double best = 0.0;
+  for (unsigned i = 0; i < repeat; i++) {
+    auto time0 = std::chrono::high_resolution_clock::now();
+    f();
+    auto time1 = std::chrono::high_resolution_clock::now();
+    auto e = std::chrono::duration<double>(time1 - time0).count();
+    if (i == 0 || e < best) best = e;
+  }
+  return best;
+}
@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common.h"
+#include "Bench.h"
+
+// Interns the strings a parse of an rvm and att pair interns, from a number of threads, with
+// a number of shards. Each group brings its name, which is new, and six attributes, where the
+// keys and most values are already interned. The strings are split into one contiguous range
+// per thread, like the parse tasks split a file.
+//
+// Used to pick the shard count of StringInterning. More shards cost single-threaded
+// throughput, as the strings spread over more maps and arena pages, and fewer shards mean more
+// threads waiting for the same lock.
+
+namespace {
+
+  struct Workload
+  {
+    std::string chars;
+    std::vector<size_t> offsets;  // String i is chars[offsets[i], offsets[i+1]).
+  };
+
+  void add(Workload& workload, const char* str)
+  {
+    workload.chars.append(str);
+    workload.offsets.push_back(workload.chars.size());
+  }
+
+  void buildWorkload(Workload& workload, unsigned groups)
+  {
+    static const char* types[] = { "PIPE", "BRAN", "ELBO", "TEE", "FLAN", "VALV", "REDU", "GASK", "ATTA", "SUPP" };
+    static const char* keys[] = { ":NAME", ":TYPE", ":OWNER", ":SPREF", ":BORE", ":LOCK" };
+
+    char name[256], owner[128], value[128];
+    srand(42);
+    workload.offsets.push_back(0);
+    for (unsigned i = 0; i < groups; i++) {
+      auto * type = types[rand() % 10];
+      snprintf(owner, sizeof(owner), "/SITE-%02u/ZONE-%03u/PIPE-%05u", i / 20000, (i / 500) % 40, i / 25);
+      snprintf(name, sizeof(name), "%s/%s %u", owner, type, i % 25 + 1);
+      add(workload, name);
+
+      add(workload, keys[0]);
+      add(workload, name);
+      add(workload, keys[1]);
+      add(workload, type);
+      add(workload, keys[2]);
+      add(workload, owner);
+      add(workload, keys[3]);
+      snprintf(value, sizeof(value), "/SPEC-%03u/%s", unsigned(rand() % 400), type);
+      add(workload, value);
+      add(workload, keys[4]);
+      snprintf(value, sizeof(value), "%umm", 15u + 5u * unsigned(rand() % 80));
+      add(workload, value);
+      add(workload, keys[5]);
+      add(workload, rand() % 2 ? "true" : "false");
+    }
+  }
+
+  void internRange(StringInterning& strings, const Workload& workload, size_t a, size_t b)
+  {
+    auto * chars = workload.chars.data();
+    for (size_t i = a; i < b; i++) {
+      strings.intern(chars + workload.offsets[i], chars + workload.offsets[i + 1]);
+    }
+  }
+
+  double run(const Workload& workload, unsigned threads, unsigned shardBits)
+  {
+    StringInterning strings(shardBits);
+    auto n = workload.offsets.size() - 1;
+    if (threads == 1) {
+      internRange(strings, workload, 0, n);
+    }
+    else {
+      std::vector<std::thread> workers;
+      for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back(internRange, std::ref(strings), std::cref(workload), (n * t) / threads, (n * (t + 1)) / threads);
+      }
+      for (auto & w : workers) {
+        w.join();
+      }
+    }
+    return double(n);
+  }
+
+}
+
+int benchInterning(int argc, char** argv)
+{
+  unsigned groups = 100000;
+  unsigned repeat = 3;
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "--groups=", 9) == 0) groups = unsigned(std::strtoul(argv[i] + 9, nullptr, 10));
+    else if (strncmp(argv[i], "--repeat=", 9) == 0) repeat = unsigned(std::strtoul(argv[i] + 9, nullptr, 10));
+    else {
+      fprintf(stderr, "Usage: interning [--groups=<n>] [--repeat=<n>]\n");
+      return -1;
+    }
+  }
+
+  Workload workload;
+  buildWorkload(workload, groups);
+
+  const unsigned shardBits[] = { 0, 2, 4, 6, 8 };
+  printf("%u strings, %u hardware threads, million interns per second:\n", unsigned(workload.offsets.size() - 1), std::thread::hardware_concurrency());
+  printf("threads");
+  for (auto bits : shardBits) printf("  %4u shards", 1u << bits);
+  printf("\n");
+  for (unsigned threads = 1; threads <= 64; threads *= 2) {
+    printf("%7u", threads);
+    for (auto bits : shardBits) {
+      double n = 0.0;
+      auto e = bestOf(repeat, [&]() { n = run(workload, threads, bits); });
+      printf("  %11.2f", 1e-6 * n / e);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Store.h"
+#include "Parser.h"
+#include "Bench.h"
+
+// Parses a generated att file and reports megabytes per second. The file is one root group
+// with a few levels of children, indented two spaces per level, where each group has two
+// lines of attributes separated by &end&. The parse column creates groups and attributes. The
+// scan column discards the root group, so every line but the first is only scanned for its
+// indentation, NEW or END and the end of line, which is the scanner alone.
+
+namespace {
+
+  void buildGroup(std::string& att, const std::string& name, unsigned depth, unsigned fanout, unsigned& groups)
+  {
+    static const char* types[] = { "PIPE", "BRAN", "ELBO", "TEE", "FLAN", "VALV", "REDU", "GASK" };
+
+    std::string indent(2 * depth, ' ');
+    auto * type = types[groups % 8];
+    char line[512];
+    snprintf(line, sizeof(line),
+             "%sNEW %s\n"
+             "%s:NAME := '%s' &end& :TYPE := %s &end& :OWNER := '%s' &end& :LOCK := false\n"
+             "%s:DESC := 'Generated %s number %u at depth %u' &end& :BORE := %umm &end& :SPREF := '/SPEC/%s'\n",
+             indent.c_str(), name.c_str(),
+             indent.c_str(), name.c_str(), type, name.substr(0, name.rfind('/')).c_str(),
+             indent.c_str(), type, groups, depth, 15 + 5 * (groups % 80), type);
+    att.append(line);
+    groups++;
+
+    if (depth < 4) {
+      for (unsigned i = 0; i < fanout; i++) {
+        buildGroup(att, name + "/" + type + "-" + std::to_string(i), depth + 1, fanout, groups);
+      }
+    }
+    att.append(indent);
+    att.append("END\n");
+  }
+
+  double parse(const std::string& att, const DiscardList* discard)
+  {
+    Store store;
+    if (!parseAtt(&store, benchLogger, att.data(), att.size(), true, discard)) {
+      fprintf(stderr, "Failed to parse generated att\n");
+      exit(-1);
+    }
+    return double(att.size());
+  }
+
+}
+
+int benchParseAtt(int argc, char** argv)
+{
+  unsigned fanout = 16;
+  unsigned repeat = 3;
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "--fanout=", 9) == 0) fanout = unsigned(std::strtoul(argv[i] + 9, nullptr, 10));
+    else if (strncmp(argv[i], "--repeat=", 9) == 0) repeat = unsigned(std::strtoul(argv[i] + 9, nullptr, 10));
+    else {
+      fprintf(stderr, "Usage: att [--fanout=<n>] [--repeat=<n>]\n");
+      return -1;
+    }
+  }
+
+  std::string att = "CADC_Attributes_File v1.0 , start: NEW END , name_end: END , sep: := , sep_end: &end&\n";
+  unsigned groups = 0;
+  buildGroup(att, "/BENCH", 0, fanout, groups);
+
+  DiscardList discard;
+  discard.names.intern("/BENCH");
+
+  double n = 0.0;
+  auto p = bestOf(repeat, [&]() { n = parse(att, nullptr); });
+  auto s = bestOf(repeat, [&]() { n = parse(att, &discard); });
+  printf("%u groups, %.1f MB, megabytes per second:\n", groups, 1e-6 * n);
+  printf("%10s %10s\n", "parse", "scan");
+  printf("%10.1f %10.1f\n", 1e-6 * n / p, 1e-6 * n / s);
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Store.h"
+#include "Parser.h"
+#include "Bench.h"
+
+// Parses a generated rvm file of facet groups and reports megabytes per second. Each group
+// holds a number of facet groups, each with polygons of one contour of a given number of
+// vertices, so nearly all of the file is big-endian vertex and normal data. The lazy column
+// parses with lazyFacetGroups set, where facet groups are stepped over and not decoded, which
+// leaves the cost of everything but the decoding.
+
+namespace {
+
+  struct Writer
+  {
+    std::string bytes;
+
+    void u32(uint32_t v)
+    {
+      char b[4] = { char(v >> 24), char(v >> 16), char(v >> 8), char(v) };
+      bytes.append(b, 4);
+    }
+
+    void f32(float f)
+    {
+      uint32_t v;
+      std::memcpy(&v, &f, sizeof(v));
+      u32(v);
+    }
+
+    // Length in words followed by the zero-padded string.
+    void str(const char* s)
+    {
+      auto l = std::strlen(s);
+      auto words = uint32_t(l / 4 + 1);
+      u32(words);
+      bytes.append(s, l);
+      bytes.append(4 * words - l, '\0');
+    }
+
+    // Writes a chunk header and returns the position of its next chunk offset.
+    size_t chunk(const char* id)
+    {
+      for (unsigned i = 0; i < 4; i++) u32(uint8_t(id[i]));
+      auto at = bytes.size();
+      u32(0);
+      u32(0);
+      return at;
+    }
+
+    void end(size_t at)
+    {
+      auto offset = uint32_t(bytes.size());
+      char b[4] = { char(offset >> 24), char(offset >> 16), char(offset >> 8), char(offset) };
+      std::memcpy(&bytes[at], b, 4);
+    }
+  };
+
+  void buildFile(Writer& w, unsigned groups, unsigned facetGroups, unsigned polygons, unsigned vertices)
+  {
+    auto at = w.chunk("HEAD");
+    w.u32(2);
+    w.str("rvmbench");
+    w.str("");
+    w.str("");
+    w.str("");
+    w.str("UTF-8");
+    w.end(at);
+
+    at = w.chunk("MODL");
+    w.u32(1);
+    w.str("BENCH");
+    w.str("bench");
+    w.end(at);
+
+    char name[64];
+    for (unsigned g = 0; g < groups; g++) {
+      at = w.chunk("CNTB");
+      w.u32(2);
+      snprintf(name, sizeof(name), "/GROUP-%u", g);
+      w.str(name);
+      for (unsigned i = 0; i < 3; i++) w.f32(0.f);
+      w.u32(g % 16);
+      w.end(at);
+
+      for (unsigned f = 0; f < facetGroups; f++) {
+        at = w.chunk("PRIM");
+        w.u32(1);
+        w.u32(11);
+        const float M[12] = { 1.f, 0.f, 0.f,  0.f, 1.f, 0.f,  0.f, 0.f, 1.f,  float(g), float(f), 0.f };
+        for (auto m : M) w.f32(m);
+        const float bbox[6] = { -1.f, -1.f, -1.f, 1.f, 1.f, 1.f };
+        for (auto b : bbox) w.f32(b);
+        w.u32(polygons);
+        for (unsigned p = 0; p < polygons; p++) {
+          w.u32(1);
+          w.u32(vertices);
+          for (unsigned v = 0; v < vertices; v++) {
+            float t = float(p) + 0.1f * float(v);
+            w.f32(t); w.f32(0.5f * t); w.f32(0.25f * t);
+            w.f32(0.f); w.f32(0.f); w.f32(1.f);
+          }
+        }
+        w.end(at);
+      }
+
+      at = w.chunk("CNTE");
+      w.u32(1);
+      w.end(at);
+    }
+
+    at = w.chunk("END:");
+    w.u32(1);
+    w.end(at);
+  }
+
+  double parse(const Writer& w, bool lazy)
+  {
+    Store store;
+    if (!parseRVM(&store, benchLogger, "bench.rvm", w.bytes.data(), w.bytes.size(), 1, lazy)) {
+      fprintf(stderr, "Failed to parse generated rvm: %s\n", store.errorString());
+      exit(-1);
+    }
+    return double(w.bytes.size());
+  }
+
+}
+
+int benchParseRVM(int argc, char** argv)
+{
+  unsigned groups = 250;
+  unsigned repeat = 3;
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "--groups=", 9) == 0) groups = unsigned(std::strtoul(argv[i] + 9, nullptr, 10));
+    else if (strncmp(argv[i], "--repeat=", 9) == 0) repeat = unsigned(std::strtoul(argv[i] + 9, nullptr, 10));
+    else {
+      fprintf(stderr, "Usage: rvm [--groups=<n>] [--repeat=<n>]\n");
+      return -1;
+    }
+  }
+
+  // Triangles and quads are the common case, larger contours come from caps and plates.
+  const unsigned vertices[] = { 3, 4, 8, 16 };
+
+  printf("%u groups of 10 facet groups, megabytes per second:\n", groups);
+  printf("%8s %10s %10s %10s\n", "vertices", "MB", "eager", "lazy");
+  for (auto v : vertices) {
+    Writer w;
+    buildFile(w, groups, 10, 2400 / v, v);
+
+    double n = 0.0;
+    auto e = bestOf(repeat, [&]() { n = parse(w, false); });
+    auto l = bestOf(repeat, [&]() { n = parse(w, true); });
+    printf("%8u %10.1f %10.1f %10.1f\n", v, 1e-6 * n, 1e-6 * n / e, 1e-6 * n / l);
+  }
+  return 0;
+}
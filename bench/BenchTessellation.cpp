@@ -0,0 +1,149 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Store.h"
+#include "Tessellator.h"
+#include "LinAlgOps.h"
+#include "Bench.h"
+
+// Tessellates one primitive of each kind over and over, at a few sizes relative to the
+// tolerance, and reports primitives and vertices per second. The primitives have no
+// connections, so all caps are made.
+
+namespace {
+
+  const float pi = float(M_PI);
+  const float half_pi = float(0.5*M_PI);
+
+  struct Shape
+  {
+    const char* name;
+    Geometry::Kind kind;
+  };
+
+  const Shape shapes[] = {
+    { "Pyramid", Geometry::Kind::Pyramid },
+    { "Box", Geometry::Kind::Box },
+    { "RectangularTorus", Geometry::Kind::RectangularTorus },
+    { "CircularTorus", Geometry::Kind::CircularTorus },
+    { "EllipticalDish", Geometry::Kind::EllipticalDish },
+    { "SphericalDish", Geometry::Kind::SphericalDish },
+    { "Snout", Geometry::Kind::Snout },
+    { "Cylinder", Geometry::Kind::Cylinder },
+    { "Sphere", Geometry::Kind::Sphere },
+  };
+
+  void setup(Geometry& geo, Geometry::Kind kind, float r)
+  {
+    geo.kind = kind;
+    const float identity[12] = { 1.f, 0.f, 0.f,  0.f, 1.f, 0.f,  0.f, 0.f, 1.f,  0.f, 0.f, 0.f };
+    geo.M_3x4 = makeMat3x4f(identity);
+    switch (kind) {
+    case Geometry::Kind::Pyramid:
+      geo.pyramid = { { 2.f * r, 2.f * r }, { r, r }, { 0.2f * r, 0.f }, 2.f * r };
+      break;
+    case Geometry::Kind::Box:
+      geo.box = { { 2.f * r, r, 3.f * r } };
+      break;
+    case Geometry::Kind::RectangularTorus:
+      geo.rectangularTorus = { 2.f * r, 3.f * r, r, half_pi };
+      break;
+    case Geometry::Kind::CircularTorus:
+      geo.circularTorus = { 3.f * r, r, half_pi };
+      break;
+    case Geometry::Kind::EllipticalDish:
+      geo.ellipticalDish = { r, 0.5f * r };
+      break;
+    case Geometry::Kind::SphericalDish:
+      geo.sphericalDish = { r, 0.5f * r };
+      break;
+    case Geometry::Kind::Snout:
+      geo.snout = { { 0.2f * r, 0.f }, { 0.1f, 0.f }, { 0.f, 0.1f }, r, 0.6f * r, 2.f * r };
+      break;
+    case Geometry::Kind::Cylinder:
+      geo.cylinder = { r, 2.f * r };
+      break;
+    case Geometry::Kind::Sphere:
+      geo.sphere = { 2.f * r };
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Same dispatch as the tessellator.
+  Triangulation* tessellate(TriangulationFactory& factory, Arena* arena, const Geometry* geo)
+  {
+    switch (geo->kind) {
+    case Geometry::Kind::Pyramid: return factory.pyramid(arena, geo, 1.f);
+    case Geometry::Kind::Box: return factory.box(arena, geo, 1.f);
+    case Geometry::Kind::RectangularTorus: return factory.rectangularTorus(arena, geo, 1.f);
+    case Geometry::Kind::CircularTorus: return factory.circularTorus(arena, geo, 1.f);
+    case Geometry::Kind::EllipticalDish:
+      return factory.sphereBasedShape(arena, geo, geo->ellipticalDish.baseRadius, half_pi, 0.f, geo->ellipticalDish.height / geo->ellipticalDish.baseRadius, 1.f);
+    case Geometry::Kind::SphericalDish: {
+      float r_circ = geo->sphericalDish.baseRadius;
+      auto h = geo->sphericalDish.height;
+      float r_sphere = (r_circ*r_circ + h * h) / (2.f*h);
+      float sinval = std::min(1.f, std::max(-1.f, r_circ / r_sphere));
+      float arc = std::asin(sinval);
+      if (r_circ < h) { arc = pi - arc; }
+      return factory.sphereBasedShape(arena, geo, r_sphere, arc, h - r_sphere, 1.f, 1.f);
+    }
+    case Geometry::Kind::Snout: return factory.snout(arena, geo, 1.f);
+    case Geometry::Kind::Cylinder: return factory.cylinder(arena, geo, 1.f);
+    case Geometry::Kind::Sphere: return factory.sphereBasedShape(arena, geo, 0.5f*geo->sphere.diameter, pi, 0.f, 1.f, 1.f);
+    default: return nullptr;
+    }
+  }
+
+}
+
+int benchTessellation(int argc, char** argv)
+{
+  float tolerance = 0.01f;
+  unsigned repeat = 3;
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "--tolerance=", 12) == 0) tolerance = std::strtof(argv[i] + 12, nullptr);
+    else if (strncmp(argv[i], "--repeat=", 9) == 0) repeat = unsigned(std::strtoul(argv[i] + 9, nullptr, 10));
+    else {
+      fprintf(stderr, "Usage: tessellation [--tolerance=<t>] [--repeat=<n>]\n");
+      return -1;
+    }
+  }
+
+  Store store;
+  TriangulationFactory factory(&store, benchLogger, tolerance, 3, 100);
+  Arena arena;
+
+  // Radii of roughly 3, 30 and 300 tolerances give small, medium and large sample counts.
+  const float radii[] = { 3.f * tolerance, 30.f * tolerance, 300.f * tolerance };
+
+  printf("tolerance %g, thousand primitives and million vertices per second:\n", tolerance);
+  printf("%-18s %10s %10s %12s %12s\n", "kind", "radius", "vertices", "kprims/s", "Mverts/s");
+  for (const auto & shape : shapes) {
+    for (auto r : radii) {
+      Geometry geo;
+      setup(geo, shape.kind, r);
+
+      auto * tri = tessellate(factory, &arena, &geo);
+      unsigned vertices = tri ? tri->vertices_n : 0;
+      arena.reset();
+
+      // Make about 20 million vertices per run.
+      unsigned n = std::max(1000u, 20000000u / std::max(1u, vertices));
+      auto e = bestOf(repeat, [&]() {
+        for (unsigned i = 0; i < n; i++) {
+          tessellate(factory, &arena, &geo);
+          arena.reset();
+        }
+      });
+      printf("%-18s %10g %10u %12.1f %12.1f\n", shape.name, r, vertices, 1e-3 * n / e, 1e-6 * double(n) * vertices / e);
+    }
+  }
+  return 0;
+}
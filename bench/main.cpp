@@ -0,0 +1,64 @@
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <mutex>
+
+#include "Bench.h"
+
+void benchLogger(unsigned level, const char* msg, ...)
+{
+  if (level == 0) return;
+
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  fprintf(stderr, level == 1 ? "[W] " : "[E] ");
+
+  va_list argptr;
+  va_start(argptr, msg);
+  vfprintf(stderr, msg, argptr);
+  va_end(argptr);
+  fprintf(stderr, "\n");
+}
+
+namespace {
+
+  struct Benchmark
+  {
+    const char* name;
+    int(*run)(int argc, char** argv);
+    const char* description;
+  };
+
+  const Benchmark benchmarks[] = {
+    { "att", benchParseAtt, "Megabytes per second when parsing and when only scanning an att file." },
+    { "interning", benchInterning, "StringInterning throughput from 1 to 64 threads and shard counts." },
+    { "rvm", benchParseRVM, "Megabytes per second when parsing an rvm file of facet groups." },
+    { "tessellation", benchTessellation, "Primitives and vertices per second for each kind of primitive." },
+  };
+
+  void printHelp(const char* argv0)
+  {
+    fprintf(stderr, "Usage: %s benchmark [options]\n\nBenchmarks:\n", argv0);
+    for (const auto & benchmark : benchmarks) {
+      fprintf(stderr, "  %-16s%s\n", benchmark.name, benchmark.description);
+    }
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    printHelp(argv[0]);
+    return -1;
+  }
+  for (const auto & benchmark : benchmarks) {
+    if (strcmp(argv[1], benchmark.name) == 0) {
+      return benchmark.run(argc - 2, argv + 2);
+    }
+  }
+  fprintf(stderr, "Unknown benchmark '%s'\n", argv[1]);
+  printHelp(argv[0]);
+  return -1;
+}
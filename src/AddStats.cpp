@@ -1,6 +1,7 @@
 #include <cassert>
 #include "Store.h"
 #include "AddStats.h"
+#include "Parser.h"
 
 void AddStats::init(class Store& store)
 {
@@ -29,22 +30,25 @@ void AddStats::geometry(struct Geometry* geo)
   case Geometry::Kind::FacetGroup:
     stats->facetgroup_n++;
 
-    for (unsigned p = 0; p < geo->facetGroup.polygons_n; p++) {
-      auto & poly = geo->facetGroup.polygons[p];
-      if (poly.contours_n == 1 && poly.contours[0].vertices_n == 3) {
-        stats->facetgroup_triangles_n++;
-      }
-      else if (poly.contours_n == 1 && poly.contours[0].vertices_n == 4) {
-        stats->facetgroup_quads_n++;
-      }
-      else {
-        stats->facetgroup_polygon_n++;
-        stats->facetgroup_polygon_n_contours_n += geo->facetGroup.polygons[p].contours_n;
-        for (unsigned c = 0; c < geo->facetGroup.polygons[p].contours_n; c++) {
-          stats->facetgroup_polygon_n_vertices_n += geo->facetGroup.polygons[p].contours[c].vertices_n;
+    if (auto * polygons = facetGroupPolygons(&scratch, geo)) {
+      for (unsigned p = 0; p < geo->facetGroup.polygons_n; p++) {
+        auto & poly = polygons[p];
+        if (poly.contours_n == 1 && poly.contours[0].vertices_n == 3) {
+          stats->facetgroup_triangles_n++;
+        }
+        else if (poly.contours_n == 1 && poly.contours[0].vertices_n == 4) {
+          stats->facetgroup_quads_n++;
+        }
+        else {
+          stats->facetgroup_polygon_n++;
+          stats->facetgroup_polygon_n_contours_n += poly.contours_n;
+          for (unsigned c = 0; c < poly.contours_n; c++) {
+            stats->facetgroup_polygon_n_vertices_n += poly.contours[c].vertices_n;
+          }
         }
       }
     }
+    scratch.reset();
     
     break;
   case Geometry::Kind::Line: stats->line_n++; break;
@@ -1,4 +1,5 @@
 #pragma once
+#include "Common.h"
 #include "StoreVisitor.h"
 
 struct Stats
@@ -39,5 +40,6 @@ public:
 
 private:
   struct Stats* stats = nullptr;
+  Arena scratch;
 
 };
\ No newline at end of file
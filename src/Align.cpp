@@ -1,5 +1,7 @@
 #include <cassert>
 #include <chrono>
+#include <thread>
+#include <vector>
 #include "Store.h"
 #include "LinAlgOps.h"
 
@@ -26,6 +28,25 @@ namespace {
 
   };
 
+  bool isCircular(const Connection* connection)
+  {
+    return !connection->hasFlag(Connection::Flags::HasRectangularSide);
+  }
+
+  bool propagatesAlignment(const Geometry* geo)
+  {
+    switch (geo->kind) {
+    case Geometry::Kind::Snout:
+    case Geometry::Kind::EllipticalDish:
+    case Geometry::Kind::SphericalDish:
+    case Geometry::Kind::Cylinder:
+    case Geometry::Kind::CircularTorus:
+      return true;
+    default:
+      return false;
+    }
+  }
+
   void enqueue(Context& context, Geometry* from, Connection* connection, const Vec3f& upWorld)
   {
     connection->temp = 1;
@@ -177,28 +198,9 @@ namespace {
     }
   }
 
-}
-
-void align(Store* store, Logger logger)
-{
-  Context context;
-  context.logger = logger;
-  context.store = store;
-  auto time0 = std::chrono::high_resolution_clock::now();
-  for (auto * connection = store->getFirstConnection(); connection != nullptr; connection = connection->next) {
-    connection->temp = 0;
-
-    if (connection->flags == Connection::Flags::HasCircularSide) {
-      context.circularConnections++;
-    }
-    context.connections++;
-  }
-
-
-  context.queue.accommodate(context.connections);
-  for (auto * connection = store->getFirstConnection(); connection != nullptr; connection = connection->next) {
-    if (connection->temp || connection->hasFlag(Connection::Flags::HasRectangularSide)) continue;
-
+  // Aligns the component of connections reached from the seed connection.
+  void alignComponent(Context& context, Connection* connection)
+  {
     // Create an arbitrary vector in plane of intersection as seed.
     const auto & d = connection->d;
     Vec3f b;
@@ -221,8 +223,130 @@ void align(Store* store, Logger logger)
 
     context.connectedComponents++;
   }
+
+  unsigned findComponent(Buffer<unsigned>& parent, unsigned i)
+  {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  // Finds the connection that the serial pass would seed each component from, which is the
+  // first connection of the component in the store. Connections are joined when they meet
+  // at a geometry that passes alignment on, which is what processItem follows. Connect gives
+  // each geometry at most one connection per offset, so every connection is in the slots of
+  // both its geometries, and the walk from the seed reaches the whole component.
+  void findSeeds(std::vector<Connection*>& seeds, Connection* first, unsigned connections)
+  {
+    Buffer<Connection*> list;
+    Buffer<unsigned> parent;
+    list.accommodate(connections);
+    parent.accommodate(connections);
+
+    unsigned n = 0;
+    for (auto * connection = first; connection != nullptr; connection = connection->next) {
+      connection->temp = n;
+      list[n] = connection;
+      parent[n] = n;
+      n++;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+      if (!isCircular(list[i])) continue;
+      for (auto * geo : list[i]->geo) {
+        if (!propagatesAlignment(geo)) continue;
+        for (unsigned k = 0; k < 2; k++) {
+          auto * other = geo->connections[k];
+          if (other == nullptr || !isCircular(other)) continue;
+
+          // The component is represented by its first connection.
+          auto a = findComponent(parent, i);
+          auto b = findComponent(parent, other->temp);
+          if (a < b) parent[b] = a;
+          else if (b < a) parent[a] = b;
+        }
+      }
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+      if (isCircular(list[i]) && findComponent(parent, i) == i) {
+        seeds.push_back(list[i]);
+      }
+      list[i]->temp = 0;
+    }
+  }
+
+}
+
+void align(Store* store, Logger logger, unsigned threads)
+{
+  Context context;
+  context.logger = logger;
+  context.store = store;
+  auto time0 = std::chrono::high_resolution_clock::now();
+
+  // Connections are only appended, and new ones only involve new geometries, so aligning the
+  // connections made since the last pass leaves earlier components as they were.
+  if (store->conn == nullptr) {
+    store->conn = store->arena.alloc<Connectivity>();
+  }
+  auto * conn = store->conn;
+  auto * first = conn->lastAligned ? conn->lastAligned->next : store->getFirstConnection();
+  if (store->getLastConnection()) {
+    conn->lastAligned = store->getLastConnection();
+  }
+
+  for (auto * connection = first; connection != nullptr; connection = connection->next) {
+    connection->temp = 0;
+
+    if (connection->flags == Connection::Flags::HasCircularSide) {
+      context.circularConnections++;
+    }
+    context.connections++;
+  }
+
+  context.queue.accommodate(context.connections);
+  if (threads <= 1) {
+    for (auto * connection = first; connection != nullptr; connection = connection->next) {
+      if (connection->temp || !isCircular(connection)) continue;
+      alignComponent(context, connection);
+    }
+  }
+  else {
+    // Components share no geometries, and are aligned the same way whatever thread they
+    // end up on, as long as they are seeded from the same connection.
+    std::vector<Connection*> seeds;
+    findSeeds(seeds, first, context.connections);
+
+    std::atomic<size_t> next = 0;
+    auto workers_n = unsigned(std::min(size_t(threads), seeds.size()));
+    std::vector<unsigned> components(workers_n);
+    auto worker = [&](unsigned t) {
+      Context workerContext;
+      workerContext.logger = logger;
+      workerContext.store = store;
+      workerContext.connections = context.connections;
+      workerContext.queue.accommodate(context.connections);
+      for (size_t i = next++; i < seeds.size(); i = next++) {
+        alignComponent(workerContext, seeds[i]);
+      }
+      components[t] = workerContext.connectedComponents;
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < workers_n; t++) {
+      workers.emplace_back(worker, t);
+    }
+    for (auto & w : workers) {
+      w.join();
+    }
+    for (auto c : components) {
+      context.connectedComponents += c;
+    }
+  }
   auto time1 = std::chrono::high_resolution_clock::now();
   auto e0 = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
 
   logger(0, "%d connected components in %d circular connections (%lldms).", context.connectedComponents, context.circularConnections, e0);
-}
\ No newline at end of file
+}
@@ -1,3 +1,20 @@
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#else
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cerrno>
+
+#endif
+
 #include "Common.h"
 #include <cstdlib>
 #include <cstdio>
@@ -110,6 +127,44 @@ void* Arena::dup(const void* src, size_t bytes)
 }
 
 
+void Arena::reset()
+{
+  if (curr == nullptr) return;
+
+  auto * c = first;
+  while (c != curr) {
+    auto * n = *(uint8_t**)c;
+    free(c);
+    c = n;
+  }
+  first = curr;
+  fill = sizeof(uint8_t*);
+}
+
+void Arena::adopt(Arena& other)
+{
+  if (other.first == nullptr) return;
+
+  if (first == nullptr) {
+    first = other.first;
+    curr = other.curr;
+    fill = other.fill;
+    size = other.size;
+  }
+  else {
+    // Splice the pages of other in front of ours, so curr is still the
+    // page we allocate from.
+    *(uint8_t**)other.curr = first;
+    first = other.first;
+  }
+
+  other.first = nullptr;
+  other.curr = nullptr;
+  other.fill = 0;
+  other.size = 0;
+}
+
+
 void Arena::clear()
 {
   auto * c = first;
@@ -124,6 +179,95 @@ void Arena::clear()
   size = 0;
 }
 
+bool MappedFile::map(Logger logger, const char* path, bool sequential)
+{
+  assert(ptr == nullptr);
+#ifdef _WIN32
+
+  HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS), NULL);
+  if (h == INVALID_HANDLE_VALUE) {
+    logger(2, "CreateFileA returned INVALID_HANDLE_VALUE");
+    return false;
+  }
+
+  DWORD hiSize;
+  DWORD loSize = GetFileSize(h, &hiSize);
+  size_t fileSize = (size_t(hiSize) << 32u) + loSize;
+
+  HANDLE m = CreateFileMappingA(h, 0, PAGE_READONLY, 0, 0, NULL);
+  if (m == INVALID_HANDLE_VALUE) {
+    logger(2, "CreateFileMappingA returned INVALID_HANDLE_VALUE");
+    CloseHandle(h);
+    return false;
+  }
+
+  // The view keeps the mapping alive after the handles are closed.
+  const void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(m);
+  CloseHandle(h);
+  if (view == nullptr) {
+    logger(2, "MapViewOfFile returned INVALID_HANDLE_VALUE");
+    return false;
+  }
+  ptr = view;
+  size = fileSize;
+  return true;
+
+#else
+
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) {
+    logger(2, "%s: open failed: %s", path, strerror(errno));
+    return false;
+  }
+
+  struct stat stat{};
+  if(fstat(fd, &stat) != 0) {
+    logger(2, "%s: fstat failed: %s", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+
+#ifdef __linux__
+  void * view = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE|(sequential ? MAP_POPULATE : 0), fd, 0);
+#else
+  void * view = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+  close(fd);  // The mapping stays valid after the descriptor is closed.
+  if(view == MAP_FAILED) {
+    logger(2, "%s: mmap failed: %s", path, strerror(errno));
+    return false;
+  }
+
+  if(madvise(view, stat.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM) != 0) {
+    logger(1, "%s: madvise failed: %s", path, strerror(errno));
+  }
+  ptr = view;
+  size = stat.st_size;
+  return true;
+
+#endif
+}
+
+bool MappedFile::unmap(Logger logger)
+{
+  if (ptr == nullptr) return true;
+
+  bool rv = true;
+#ifdef _WIN32
+  UnmapViewOfFile(ptr);
+#else
+  if(munmap(const_cast<void*>(ptr), size) != 0) {
+    if (logger) logger(2, "munmap failed: %s", strerror(errno));
+    rv = false;
+  }
+#endif
+  ptr = nullptr;
+  size = 0;
+  return rv;
+}
+
 Map::~Map()
 {
   free(keys);
@@ -139,7 +283,7 @@ void Map::clear()
   fill = 0;
 }
 
-bool Map::get(uint64_t& val, uint64_t key)
+bool Map::get(uint64_t& val, uint64_t key) const
 {
   assert(key != 0);
   if (fill == 0) return false;
@@ -157,7 +301,7 @@ bool Map::get(uint64_t& val, uint64_t key)
   }
 }
 
-uint64_t Map::get(uint64_t key)
+uint64_t Map::get(uint64_t key) const
 {
   uint64_t rv = 0;
   get(rv, key);
@@ -221,11 +365,40 @@ namespace {
 
 }
 
+StringInterning::StringInterning(unsigned shardBits) :
+  shards(new Shard[size_t(1) << shardBits]),
+  shardBits(shardBits)
+{
+  assert(shardBits < 32);
+}
+
+StringInterning::~StringInterning()
+{
+  delete[] shards;
+}
+
 const char* StringInterning::intern(const char* str)
 {
   return intern(str, str + strlen(str));
 }
 
+const char* StringInterning::find(const char* a, const char* b) const
+{
+  assert(a <= b);
+  const size_t length = b - a;
+  uint64_t hash = fnv_1a(a, length);
+  hash = hash ? hash : 1;
+
+  auto & s = shard(hash);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  for (auto * it = (const StringHeader*)s.map.get(hash); it != nullptr; it = it->next) {
+    if (it->length == length && strncmp(it->string, a, length) == 0) {
+      return it->string;
+    }
+  }
+  return nullptr;
+}
+
 const char* StringInterning::intern(const char* a, const char* b)
 {
   assert(a <= b);
@@ -233,7 +406,9 @@ const char* StringInterning::intern(const char* a, const char* b)
   uint64_t hash = fnv_1a(a, length);
   hash = hash ? hash : 1;
 
-  auto * intern = (StringHeader*)map.get(hash);
+  auto & s = shard(hash);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto * intern = (StringHeader*)s.map.get(hash);
   for (auto * it = intern; it != nullptr; it = it->next) {
     if (it->length == length) {
       if (strncmp(it->string, a, length) == 0) {
@@ -242,11 +417,11 @@ const char* StringInterning::intern(const char* a, const char* b)
     }
   }
 
-  auto * newIntern = (StringHeader*)arena.alloc(sizeof(StringHeader) + length);
+  auto * newIntern = (StringHeader*)s.arena.alloc(sizeof(StringHeader) + length);
   newIntern->next = intern;
   newIntern->length = length;
   std::memcpy(newIntern->string, a, length);
   newIntern->string[length] = '\0';
-  map.insert(hash, uint64_t(newIntern));
+  s.map.insert(hash, uint64_t(newIntern));
   return newIntern->string;
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 #include <cstddef>
+#include <atomic>
+#include <mutex>
 
 class Store;
 
@@ -33,10 +35,30 @@ struct Arena
   void* alloc(size_t bytes);
   void* dup(const void* src, size_t bytes);
   void clear();
+  void reset();               // Releases all allocations, but keeps the last page for reuse.
+  void adopt(Arena& other);   // Takes ownership of the pages of other, leaving other empty.
 
   template<typename T> T * alloc() { return new(alloc(sizeof(T))) T(); }
 };
 
+// Read-only memory mapping of a file.
+struct MappedFile
+{
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() { unmap(nullptr); }
+
+  MappedFile* next = nullptr;
+  const void* ptr = nullptr;
+  size_t size = 0;
+
+  // Files read front to back are prefetched, otherwise pages are read when touched.
+  bool map(Logger logger, const char* path, bool sequential = true);
+  bool unmap(Logger logger);
+};
+
 struct BufferBase
 {
 protected:
@@ -86,19 +108,47 @@ struct Map
 
   void clear();
 
-  bool get(uint64_t& val, uint64_t key);
-  uint64_t get(uint64_t key);
+  bool get(uint64_t& val, uint64_t key) const;
+  uint64_t get(uint64_t key) const;
 
   void insert(uint64_t key, uint64_t value);
 };
 
+// Safe to use from multiple threads. Strings are spread over shards by hash, each with its
+// own lock, map and arena, so equal strings always return the same pointer. See
+// bench/BenchInterning.cpp for how the default shard count was chosen.
 struct StringInterning
 {
-  Arena arena;
-  Map map;
+  StringInterning(unsigned shardBits = 6);  // 2^shardBits shards.
+  StringInterning(const StringInterning&) = delete;
+  StringInterning& operator=(const StringInterning&) = delete;
+
+  ~StringInterning();
 
   const char* intern(const char* a, const char* b);
   const char* intern(const char* str);  // null terminanted
+
+  const char* find(const char* a, const char* b) const;  // Returns null if not interned.
+
+private:
+  struct Shard
+  {
+    mutable std::mutex mutex;
+    Arena arena;
+    Map map;
+  };
+  Shard* shards;
+  unsigned shardBits;
+
+  Shard& shard(uint64_t hash) { return shards[shardBits ? hash >> (64 - shardBits) : 0]; }
+  const Shard& shard(uint64_t hash) const { return shards[shardBits ? hash >> (64 - shardBits) : 0]; }
+};
+
+// Names of groups to be discarded along with their children while parsing.
+struct DiscardList
+{
+  StringInterning names;
+  std::atomic<unsigned> discarded = 0;  // Number of groups discarded so far.
 };
 
 uint64_t fnv_1a(const char* bytes, size_t l);
@@ -106,9 +156,9 @@ uint64_t fnv_1a(const char* bytes, size_t l);
 
 
 bool flattenRegex(Store* store, Logger logger, const char* regex);
-void connect(Store* store, Logger logger);
-void align(Store* store, Logger logger);
+void connect(Store* store, Logger logger, unsigned threads);
+void align(Store* store, Logger logger, unsigned threads);
 bool exportJson(Store* store, Logger logger, const char* path);
-bool discardGroups(Store* store, Logger logger, const void* ptr, size_t size);
+bool readDiscardList(DiscardList* list, Logger logger, const void* ptr, size_t size);
 bool exportRev(Store* store, Logger logger, const char* path);
-bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries);
+bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries, bool shareSeams);
@@ -2,6 +2,8 @@
 #include <algorithm>
 #include <cmath>
 #include <chrono>
+#include <thread>
+#include <vector>
 #include "Common.h"
 #include "Store.h"
 #include "LinAlgOps.h"
@@ -26,6 +28,7 @@ namespace {
     Vec3f p;
     Vec3f d;
     unsigned o;
+    unsigned seq;     // Order of creation, breaks ties between equal coordinates.
     Connection::Flags flags;
     uint8_t matched = 0;
   };
@@ -35,6 +38,9 @@ namespace {
     Store* store;
     Logger logger;
     Buffer<Anchor> anchors;
+    Buffer<Anchor> scratch;
+    Buffer<float> coords;
+    std::vector<unsigned> runs;   // Starts of runs of anchors sorted on x waiting to be merged.
     const float epsilon = 0.001f;
     unsigned anchors_n = 0;
 
@@ -45,6 +51,52 @@ namespace {
   };
 
 
+  // Number of pairs a sweep looks at when the coordinates along the sweep axis are c.
+  template<typename Coord>
+  size_t sweepPairs(Coord c, unsigned n, float e)
+  {
+    size_t pairs = 0;
+    for (unsigned j = 0, i = 0; j < n; j++) {
+      while (i < n && c(i) <= c(j) + e) i++;
+      pairs += i - j - 1;
+    }
+    return pairs;
+  }
+
+  bool lessX(const Anchor& a, const Anchor& b) { return a.p.x < b.p.x || (a.p.x == b.p.x && a.seq < b.seq); }
+
+  // Merges the two topmost runs into one.
+  void mergeTopRuns(Context* context)
+  {
+    auto * a = context->anchors.data();
+    auto * s = context->scratch.data();
+    auto end = context->anchors_n;
+    auto mid = context->runs.back();
+    context->runs.pop_back();
+    auto begin = context->runs.back();
+
+    std::copy(a + begin, a + mid, s);
+    std::merge(s, s + (mid - begin), a + mid, a + end, a + begin, lessX);
+  }
+
+  // Pushes the run of anchors from begin up to anchors_n sorted on x. Runs above base are
+  // merged while the topmost is at least as long as the one below, which keeps the stack
+  // logarithmic in the number of anchors and each anchor merged a logarithmic number of times.
+  void pushRun(Context* context, size_t base, unsigned begin)
+  {
+    auto & runs = context->runs;
+    if (begin == context->anchors_n) return;
+    runs.push_back(begin);
+    while (base + 1 < runs.size()) {
+      auto top = context->anchors_n - runs[runs.size() - 1];
+      auto below = runs[runs.size() - 1] - runs[runs.size() - 2];
+      if (top < below) break;
+      mergeTopRuns(context);
+    }
+  }
+
+  // Anchors from off up to anchors_n must be sorted on x, and the leftovers are kept sorted on
+  // x, so the parent only has to merge runs and not sort its children's anchors again.
   void connect(Context* context, unsigned off)
   {
     auto * a = context->anchors.data();
@@ -52,13 +104,37 @@ namespace {
     auto e = context->epsilon;
     auto ee = e * e;
     assert(off <= a_n);
-
-    std::sort(a + off, a + a_n, [](auto &a, auto& b) { return a.p.x < b.p.x; });
+    assert(std::is_sorted(a + off, a + a_n, lessX));
+
+    // Anchors along a straight pipe run share two coordinates. If they share x, the sweep
+    // degrades towards looking at all pairs. When the sweep along x looks at more than
+    // trigger pairs per anchor, count the pairs along the other axes and use the best one.
+    // With at most 2*trigger anchors, there can't be that many pairs.
+    const size_t trigger = 64;
+    unsigned k = 0;
+    auto n = a_n - off;
+    if (2 * trigger < n) {
+      auto best = sweepPairs([a = a + off](unsigned i) { return a[i].p.x; }, n, e);
+      if (trigger * n < best) {
+        auto * c = context->coords.data();
+        for (unsigned l = 1; l < 3; l++) {
+          for (unsigned i = 0; i < n; i++) c[i] = a[off + i].p.data[l];
+          std::sort(c, c + n);
+          if (auto pairs = sweepPairs([c](unsigned i) { return c[i]; }, n, e); pairs < best) {
+            best = pairs;
+            k = l;
+          }
+        }
+        if (k != 0) {
+          std::sort(a + off, a + a_n, [k](auto &a, auto& b) { return a.p.data[k] < b.p.data[k] || (a.p.data[k] == b.p.data[k] && a.seq < b.seq); });
+        }
+      }
+    }
 
     for (unsigned j = off; j < a_n; j++) {
       if (a[j].matched) continue;
 
-      for (unsigned i = j + 1; i < a_n && a[i].p.x <= a[j].p.x + e; i++) {
+      for (unsigned i = j + 1; i < a_n && a[i].p.data[k] <= a[j].p.data[k] + e; i++) {
 
         bool canMatch = a[i].matched == false;
         bool close = distanceSquared(a[j].p, a[i].p) <= ee;
@@ -87,18 +163,18 @@ namespace {
           //context->store->addDebugLine((a[j].p + 0.03f*a[j].d).data,
           //                             (a[i].p + 0.03f*a[i].d).data,
           //                             0x0000ff);
+
+          // An anchor is one end of a geometry and takes one connection, later partners
+          // are left for the remaining anchors.
+          break;
         }
       }
     }
 
-    // Remove matched anchors.
-    for (unsigned j = off; j < a_n; ) {
-      if (a[j].matched) {
-        std::swap(a[j], a[--a_n]);
-      }
-      else {
-        j++;
-      }
+    // Remove matched anchors, keeping the order of the rest.
+    a_n = unsigned(std::remove_if(a + off, a + a_n, [](auto& anchor) { return anchor.matched != 0; }) - a);
+    if (k != 0) {
+      std::sort(a + off, a + a_n, lessX);
     }
     assert(off <= a_n);
 
@@ -113,6 +189,7 @@ namespace {
     a.p = mul(Mat3x4f(geo->M_3x4), p);
     a.d = normalize(mul(makeMat3f(geo->M_3x4.data), d));
     a.o = o;
+    a.seq = context->anchors_total;
     a.flags = flags;
 
     //context->store->addDebugLine(a.p.data, (a.p + 0.02*a.d).data, 0x008800);
@@ -126,9 +203,13 @@ namespace {
   void recurse(Context* context, Node* group)
   {
     auto offset = context->anchors_n;
+    auto base = context->runs.size();
     for (auto * child = group->children.first; child != nullptr; child = child->next) {
+      auto begin = context->anchors_n;
       recurse(context, child);
+      pushRun(context, base, begin);
     }
+    auto begin = context->anchors_n;
     for (auto * geo = group->group.geometries.first; geo != nullptr; geo = geo->next) {
       switch (geo->kind) {
 
@@ -242,50 +323,137 @@ namespace {
         break;
       }
     }
+    std::sort(context->anchors.data() + begin, context->anchors.data() + context->anchors_n, lessX);
+    pushRun(context, base, begin);
+    while (base + 1 < context->runs.size()) {
+      mergeTopRuns(context);
+    }
+    context->runs.resize(base);
     connect(context, offset);
   }
 
+  unsigned countGeometries(const Node* group)
+  {
+    unsigned count = 0;
+    for (auto * geo = group->group.geometries.first; geo != nullptr; geo = geo->next) count++;
+    for (auto * child = group->children.first; child != nullptr; child = child->next) {
+      count += countGeometries(child);
+    }
+    return count;
+  }
+
+  // A run of top-level groups. Anchors below different top-level groups are never matched,
+  // so runs can be connected independently.
+  struct ConnectTask
+  {
+    std::vector<Node*> groups;
+    unsigned geometries = 0;
+    Store* store = nullptr;       // Receives the connections, a store of its own on worker threads.
+    unsigned anchors_total = 0;
+    unsigned anchors_matched = 0;
+  };
 
+  void connectTask(ConnectTask& task, Logger logger)
+  {
+    Context context;
+    context.store = task.store;
+    context.logger = logger;
+
+    context.anchors_max = 6 * task.geometries;
+    context.anchors.accommodate(context.anchors_max);
+    context.scratch.accommodate(context.anchors_max);
+    context.coords.accommodate(context.anchors_max);
+
+    context.anchors_n = 0;
+    for (auto * group : task.groups) {
+      recurse(&context, group);
+    }
+    for (unsigned i = 0; i < context.anchors_n; i++) {
+      auto & a = context.anchors[i];
+      assert(a.matched == false);
+
+      auto b = a.p + 0.02f*a.d;
+
+      //if (a.geo->kind == Geometry::Kind::Pyramid) {
+      //  context.store->addDebugLine(a.p.data, b.data, 0x003300);
+      //}
+      //else {
+      //  context.store->addDebugLine(a.p.data, b.data, 0xff0000);
+      //}
+    }
+    task.anchors_total = context.anchors_total;
+    task.anchors_matched = context.anchors_matched;
+  }
 
 }
 
 
-void connect(Store* store, Logger logger)
+void connect(Store* store, Logger logger, unsigned threads)
 {
+  auto time0 = std::chrono::high_resolution_clock::now();
 
-  Context context;
-  context.store = store;
-  context.logger = logger;
-
-  context.anchors_max = 6*store->geometryCountAllocated();
-  context.anchors.accommodate(context.anchors_max);
+  // Adjacent top-level groups are batched into tasks of roughly this many geometries.
+  const unsigned taskSize = threads <= 1 ? ~0u : std::max(1u, store->geometryCountAllocated() / (4 * threads));
 
+  if (store->conn == nullptr) {
+    store->conn = store->arena.alloc<Connectivity>();
+  }
+  auto * conn = store->conn;
 
-  auto time0 = std::chrono::high_resolution_clock::now();
-  context.anchors_n = 0;
-  for (auto * root = store->getFirstRoot(); root != nullptr; root = root->next) {
+  std::vector<ConnectTask> tasks;
+  for (auto * root = conn->lastRoot ? conn->lastRoot->next : store->getFirstRoot(); root != nullptr; root = root->next) {
+    conn->lastRoot = root;
     for (auto * model = root->children.first; model != nullptr; model = model->next) {
       for (auto * group = model->children.first; group != nullptr; group = group->next) {
-        recurse(&context, group);
+        if (tasks.empty() || taskSize <= tasks.back().geometries) tasks.emplace_back();
+        tasks.back().groups.push_back(group);
+        if (1 < threads) tasks.back().geometries += countGeometries(group);
+      }
+    }
+  }
+  if (threads <= 1 && !tasks.empty()) {
+    // Everything is one task, which saves walking the groups to count geometries.
+    tasks.back().geometries = store->geometryCountAllocated();
+  }
+
+  if (threads <= 1 || tasks.size() <= 1) {
+    for (auto & task : tasks) {
+      task.store = store;
+      connectTask(task, logger);
+    }
+  }
+  else {
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+      for (size_t i = next++; i < tasks.size(); i = next++) {
+        tasks[i].store = new Store();
+        connectTask(tasks[i], logger);
       }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(size_t(threads), tasks.size()); i++) {
+      workers.emplace_back(worker);
+    }
+    for (auto & w : workers) {
+      w.join();
+    }
+
+    // Adopt in visiting order, so connections are listed as when connected on one thread.
+    for (auto & task : tasks) {
+      store->adopt(task.store);
+      delete task.store;
     }
   }
-  for (unsigned i = 0; i < context.anchors_n; i++) {
-    auto & a = context.anchors[i];
-    assert(a.matched == false);
-
-    auto b = a.p + 0.02f*a.d;
-
-    //if (a.geo->kind == Geometry::Kind::Pyramid) {
-    //  context.store->addDebugLine(a.p.data, b.data, 0x003300);
-    //}
-    //else {
-    //  context.store->addDebugLine(a.p.data, b.data, 0xff0000);
-    //}
+
+  unsigned anchors_total = 0;
+  unsigned anchors_matched = 0;
+  for (auto & task : tasks) {
+    anchors_total += task.anchors_total;
+    anchors_matched += task.anchors_matched;
   }
   auto time1 = std::chrono::high_resolution_clock::now();
   auto e0 = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
 
-  logger(0, "Matched %u of %u anchors (%lldms).", context.anchors_matched, context.anchors_total, e0);
+  logger(0, "Matched %u of %u anchors (%lldms).", anchors_matched, anchors_total, e0);
 
 }
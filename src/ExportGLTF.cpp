@@ -32,6 +32,13 @@ namespace {
   };
 
   // Temporary state gathered prior to writing a GLTF file
+  struct SharedMesh
+  {
+    SharedMesh* next;
+    uint32_t material;
+    uint32_t mesh;
+  };
+
   struct Model
   {
     rj::MemoryPoolAllocator<rj::CrtAllocator> rjAlloc = rj::MemoryPoolAllocator<rj::CrtAllocator>();
@@ -48,6 +55,7 @@ namespace {
     Arena arena;
 
     Map definedMaterials;
+    Map sharedMeshes;   // Lists of SharedMesh keyed by triangulation vertex array.
 
     Vec3f origin = makeVec3f(0.f);
   };
@@ -68,6 +76,9 @@ namespace {
     std::vector<Vec3f> tmp3f_1;
     std::vector<Vec3f> tmp3f_2;
     std::vector<uint32_t> tmp32ui;
+    std::vector<uint32_t> tmpRemap;
+    std::vector<uint32_t> tmpRing;
+    std::vector<uint32_t> tmpSeamIndices;
     std::vector<GeometryItem> tmpGeos;
 
     struct {
@@ -82,6 +93,7 @@ namespace {
     bool includeAttributes = false;
     bool glbContainer = false;
     bool mergeGeometries = true;
+    bool shareSeams = false;
   };
 
 
@@ -394,29 +406,55 @@ namespace {
   {
     rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
-    rj::Value rjPrimitives(rj::kArrayType);
-    addGeometryPrimitive(ctx, model, rjPrimitives, geo);
-
-    // If no primitives were produced, no point in creating mesh and mesh-holding node
-    if (rjPrimitives.Empty()) return false;
+    // Geometries sharing a triangulation, like instances of a unit primitive, share the mesh
+    // if they have the same material.
+    const Triangulation* tri = geo->kind != Geometry::Kind::Line ? geo->triangulation : nullptr;
+    bool shareable = tri && tri->vertices && tri->vertices_n && tri->triangles_n;
+    uint32_t material = shareable ? createOrGetColor(ctx, model, geo) : 0;
+    auto * firstShared = shareable ? (SharedMesh*)model.sharedMeshes.get(uint64_t(tri->vertices)) : nullptr;
+    auto * shared = firstShared;
+    while (shared && shared->material != material) {
+      shared = shared->next;
+    }
 
-    // Create mesh
-    rj::Value mesh(rj::kObjectType);
-    mesh.AddMember("primitives", rjPrimitives, alloc);
-    uint32_t meshIndex = model.rjMeshes.Size();
-    model.rjMeshes.PushBack(mesh, alloc);
+    uint32_t meshIndex = 0;
+    if (shared) {
+      meshIndex = shared->mesh;
+    }
+    else {
+      rj::Value rjPrimitives(rj::kArrayType);
+      addGeometryPrimitive(ctx, model, rjPrimitives, geo);
+
+      // If no primitives were produced, no point in creating mesh and mesh-holding node
+      if (rjPrimitives.Empty()) return false;
+
+      // Create mesh
+      rj::Value mesh(rj::kObjectType);
+      mesh.AddMember("primitives", rjPrimitives, alloc);
+      meshIndex = model.rjMeshes.Size();
+      model.rjMeshes.PushBack(mesh, alloc);
+
+      if (shareable) {
+        shared = model.arena.alloc<SharedMesh>();
+        shared->next = firstShared;
+        shared->material = material;
+        shared->mesh = meshIndex;
+        model.sharedMeshes.insert(uint64_t(tri->vertices), uint64_t(shared));
+      }
+    }
 
     node.AddMember("mesh", meshIndex, alloc);
 
+    const Mat3x4f M = triangulationMatrix(geo);
     rj::Value matrix(rj::kArrayType);
     for (size_t c = 0; c < 3; c++) {
       for (size_t r = 0; r < 3; r++) {
-        matrix.PushBack(geo->M_3x4.cols[c][r], alloc);
+        matrix.PushBack(M.cols[c][r], alloc);
       }
       matrix.PushBack(0.f, alloc);
     }
     for (size_t r = 0; r < 3; r++) {
-      matrix.PushBack(geo->M_3x4.cols[3][r] - model.origin[r], alloc);
+      matrix.PushBack(M.cols[3][r] - model.origin[r], alloc);
     }
     matrix.PushBack(1.f, alloc);
 
@@ -466,6 +504,72 @@ namespace {
     return true;  // We did add geometry
   }
 
+  bool onSeamPlane(const Vec3f& v, const Vec3f& p, const Vec3f& d)
+  {
+    auto t = dot(v - p, d);
+    return t * t <= 1e-6f * distanceSquared(v, p);
+  }
+
+  // Lets the vertices of geo that lie on the seam of a connection to a geometry earlier in
+  // the primitive reference the vertex of that geometry with the same position and normal,
+  // which is the case for connected rings with the same number of segments, as align has
+  // lined up their sample angles. The vertices of geo are at V[vertexOffset...], remap is
+  // set to the index of each and the vertices that are left are compacted. Returns the
+  // number of vertices left.
+  size_t shareSeamVertices(Context& ctx, Map& seamGeos, const Geometry* geo, const Vec3d& localOrigin, size_t vertexOffset, size_t vertexCount)
+  {
+    std::vector<Vec3f>& V = ctx.tmp3f_1;
+    std::vector<Vec3f>& N = ctx.tmp3f_2;
+    std::vector<uint32_t>& remap = ctx.tmpRemap;
+    std::vector<uint32_t>& ring = ctx.tmpRing;
+    std::vector<uint32_t>& seamIndices = ctx.tmpSeamIndices;
+    constexpr uint32_t unset = ~0u;
+
+    remap.assign(vertexCount, unset);
+    for (auto * connection : geo->connections) {
+      if (connection == nullptr) continue;
+      auto * other = connection->geo[connection->geo[0] == geo ? 1 : 0];
+      uint64_t otherOffset = 0;
+      if (!seamGeos.get(otherOffset, uint64_t(other))) continue;
+
+      const Vec3f p = makeVec3f(makeVec3d(connection->p.data) - localOrigin);
+      const Vec3f d = connection->d;
+
+      ring.clear();
+      for (size_t j = 0; j < other->triangulation->vertices_n; j++) {
+        auto k = seamIndices[otherOffset - 1 + j];
+        if (onSeamPlane(V[k], p, d)) ring.push_back(k);
+      }
+      if (ring.empty()) continue;
+
+      for (size_t i = 0; i < vertexCount; i++) {
+        const Vec3f& v = V[vertexOffset + i];
+        if (remap[i] != unset || !onSeamPlane(v, p, d)) continue;
+
+        auto tolerance = 1e-6f * distanceSquared(v, p);
+        for (auto k : ring) {
+          if (distanceSquared(V[k], v) <= tolerance && 0.9999f < dot(N[k], N[vertexOffset + i])) {
+            remap[i] = k;
+            break;
+          }
+        }
+      }
+    }
+
+    size_t verticesLeft = 0;
+    for (size_t i = 0; i < vertexCount; i++) {
+      if (remap[i] == unset) {
+        V[vertexOffset + verticesLeft] = V[vertexOffset + i];
+        N[vertexOffset + verticesLeft] = N[vertexOffset + i];
+        remap[i] = static_cast<uint32_t>(vertexOffset + verticesLeft++);
+      }
+    }
+
+    seamGeos.insert(uint64_t(geo), seamIndices.size() + 1);
+    seamIndices.insert(seamIndices.end(), remap.begin(), remap.end());
+    return verticesLeft;
+  }
+
   bool addPrimitiveForTriangulations(Context& ctx, Model& model, rj::Value& rjPrimitives, const std::span<const GeometryItem>& geos, const Vec3d& localOrigin)
   {
     assert(!geos.empty());
@@ -475,18 +579,22 @@ namespace {
     size_t vertexOffset = 0;
     size_t indexOffset = 0;
 
+    Map seamGeos;   // Offset into ctx.tmpSeamIndices of the vertex indices of a geometry, plus one.
+    ctx.tmpSeamIndices.clear();
+
     for (const GeometryItem& item : geos) {
       const Geometry* geo = item.geo;
       assert(geo->kind != Geometry::Kind::Line);
       if (!geo->triangulation) continue;  // Skip missing triangulations
 
       // Matrix that transform from local transform to cog
-      Mat3x4d M = makeMat3x4d(geo->M_3x4.data);
+      const Mat3x4f M_3x4 = triangulationMatrix(geo);
+      Mat3x4d M = makeMat3x4d(M_3x4.data);
       M.m03 -= localOrigin.x;
       M.m13 -= localOrigin.y;
       M.m23 -= localOrigin.z;
 
-      const Mat3f T = makeMat3f(geo->M_3x4.data);
+      const Mat3f T = makeMat3f(M_3x4.data);
 
       size_t vertexCount = geo->triangulation->vertices_n;
       size_t indexCount = 3 * geo->triangulation->triangles_n;
@@ -506,8 +614,16 @@ namespace {
 
       // Transform indices
       I.resize(indexOffset + indexCount);
-      for (size_t i = 0; i < indexCount; i++) {
-        I[indexOffset + i] = static_cast<uint32_t>(vertexOffset + geo->triangulation->indices[i]);
+      if (ctx.shareSeams) {
+        vertexCount = shareSeamVertices(ctx, seamGeos, geo, localOrigin, vertexOffset, vertexCount);
+        for (size_t i = 0; i < indexCount; i++) {
+          I[indexOffset + i] = ctx.tmpRemap[geo->triangulation->indices[i]];
+        }
+      }
+      else {
+        for (size_t i = 0; i < indexCount; i++) {
+          I[indexOffset + i] = static_cast<uint32_t>(vertexOffset + geo->triangulation->indices[i]);
+        }
       }
 
       vertexOffset += vertexCount;
@@ -548,7 +664,7 @@ namespace {
       size_t nv = 0;
       for (const GeometryItem& item : geos) {
         const Geometry* geo = item.geo;
-        const Mat3x4d M = makeMat3x4d(geo->M_3x4.data);
+        const Mat3x4d M = makeMat3x4d(triangulationMatrix(geo).data);
         if (geo->kind == Geometry::Kind::Line) {
           avg = avg
               + mul(M, makeVec3d(geo->line.a, 0.0, 0.0))
@@ -724,12 +840,15 @@ namespace {
           std::vector<GeometryItem>& geos = ctx.tmpGeos;
           geos.clear();
           for (Geometry* geo = node->group.geometries.first; geo; geo = geo->next) {
+            if (geo->culled) continue;
             size_t sortKey = (static_cast<size_t>(createOrGetColor(ctx, model, geo)) << 1) | (geo->kind == Geometry::Kind::Line ? 1 : 0);
             geos.push_back({ .sortKey = sortKey, .geo = geo });
           }
 
           // Add geometries under node
-          addGeometries(ctx, model, rjNode, children, geos, node->children.first == nullptr);
+          if (!geos.empty()) {
+            addGeometries(ctx, model, rjNode, children, geos, node->children.first == nullptr);
+          }
 
         }
       }
@@ -1025,14 +1144,15 @@ namespace {
 }
 
 
-bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries)
+bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries, bool shareSeams)
 {
   Context ctx{
     .logger = logger,
     .centerModel = centerModel,
     .rotateZToY = rotateZToY,
     .includeAttributes = includeAttributes,
-    .mergeGeometries = mergeGeometries
+    .mergeGeometries = mergeGeometries,
+    .shareSeams = shareSeams
   };
   ctx.split.level = splitLevel;
 
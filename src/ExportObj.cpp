@@ -189,6 +189,8 @@ namespace {
 
 void ExportObj::geometry(struct Geometry* geometry)
 {
+  if (geometry->culled) return;
+
   uint32_t colorId = (geometry->color << 8) | geometry->transparency;
   if (!definedColors.get((uint64_t(colorId) << 1) | 1)) {
     definedColors.insert(((uint64_t(colorId) << 1) | 1), 1);
@@ -218,6 +220,7 @@ void ExportObj::geometry(struct Geometry* geometry)
   else {
     assert(geometry->triangulation);
     auto * tri = geometry->triangulation;
+    auto M = triangulationMatrix(geometry);  // Instances of unit primitives are expanded, as obj cannot share meshes.
 
     if (tri->indices != 0) {
       //fprintf(out, "g\n");
@@ -226,8 +229,8 @@ void ExportObj::geometry(struct Geometry* geometry)
       }
       for (size_t i = 0; i < 3 * tri->vertices_n; i += 3) {
 
-        auto p = scale * mul(geometry->M_3x4, makeVec3f(tri->vertices + i));
-        Vec3f n = normalize(mul(makeMat3f(geometry->M_3x4.data), makeVec3f(tri->normals + i)));
+        auto p = scale * mul(M, makeVec3f(tri->vertices + i));
+        Vec3f n = normalize(mul(makeMat3f(M.data), makeVec3f(tri->normals + i)));
         if (!std::isfinite(n.x) || !std::isfinite(n.y) || !std::isfinite(n.z)) {
           n = makeVec3f(1.f, 0.f, 0.f);
         }
@@ -242,7 +245,7 @@ void ExportObj::geometry(struct Geometry* geometry)
       }
       else {
         for (size_t i = 0; i < tri->vertices_n; i++) {
-          auto p = scale * mul(geometry->M_3x4, makeVec3f(tri->vertices + 3*i));
+          auto p = scale * mul(M, makeVec3f(tri->vertices + 3*i));
           fprintf(out, "vt %f %f\n", 0*p.x, 0*p.y);
         }
 
@@ -1,5 +1,6 @@
 #include "Common.h"
 #include "Store.h"
+#include "Parser.h"
 
 #include <cstdio>
 #include <cstring>
@@ -11,6 +12,7 @@ namespace {
     Store* store = nullptr;
     Logger logger = nullptr;
     FILE* out = nullptr;
+    Arena scratch;
   };
 
 
@@ -196,9 +198,10 @@ namespace {
       break;
     case Geometry::Kind::FacetGroup: {
       const auto& facetGroup = geometry->facetGroup;
+      const Polygon* polygons = facetGroupPolygons(&ctx->scratch, geometry);
       writeUint(ctx, facetGroup.polygons_n);
       for (size_t p = 0; p < facetGroup.polygons_n; p++) {
-        const Polygon& polygon = facetGroup.polygons[p];
+        const Polygon& polygon = polygons[p];
         writeUint(ctx, polygon.contours_n);
         for (size_t c = 0; c < polygon.contours_n; c++) {
           const Contour& contour = polygon.contours[c];
@@ -209,6 +212,7 @@ namespace {
           }
         }
       }
+      ctx->scratch.reset();
       break;
     }
     default:
@@ -234,6 +238,7 @@ namespace {
     }
 
     for (Geometry* geo = group->group.geometries.first; geo; geo = geo->next) {
+      if (geo->culled) continue;
       writeGeometry(ctx, geo);
     }
 
@@ -107,7 +107,7 @@ void Flatten::buildPrunedCopyRecurse(Node* dstParent, Node* srcGroup, unsigned l
   }
 
   for (auto * srcGeo = srcGroup->group.geometries.first; srcGeo != nullptr; srcGeo = srcGeo->next) {
-    dstStore->cloneGeometry(dstParent, srcGeo);
+    dstStore->cloneGeometry(dstParent, srcGeo, &clones);
   }
 
   for (auto * srcChild = srcGroup->children.first; srcChild != nullptr; srcChild = srcChild->next) {
@@ -118,6 +118,7 @@ void Flatten::buildPrunedCopyRecurse(Node* dstParent, Node* srcGroup, unsigned l
 Store* Flatten::run()
 {
   dstStore = new Store();
+  clones.clear();
 
   // populateSrcTags was run by the constructor, and setKeep and keepTags has changed some group.index from ~0u.
   // set group.index of parents of selected nodes to ~1u so we can retain them in the culling pass.
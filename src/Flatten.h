@@ -24,6 +24,7 @@ public:
 private:
   Map srcTags;  // All tags in source store
   Map tags;
+  Map clones;   // Triangulations and their arrays of srcStore copied into dstStore, see Store::cloneGeometry.
 
   Arena arena;
   unsigned pass = 0;
@@ -41,6 +41,20 @@ Mat3f mul(const Mat3f& A, const Mat3f& B)
                    A20 * B02 + A21 * B12 + A22 * B22);
 }
 
+Mat3x4f mul(const Mat3x4f& A, const Mat3x4f& B)
+{
+  Mat3x4f r;
+  for (size_t j = 0; j < 4; j++) {
+    for (size_t k = 0; k < 3; k++) {
+      r.data[3 * j + k] = A.data[k] * B.data[3 * j + 0] + A.data[3 + k] * B.data[3 * j + 1] + A.data[6 + k] * B.data[3 * j + 2];
+    }
+  }
+  for (size_t k = 0; k < 3; k++) {
+    r.data[9 + k] += A.data[9 + k];
+  }
+  return r;
+}
+
 float getScale(const Mat3f& M)
 {
   const float sx = length(M.cols[0]);
@@ -54,6 +54,8 @@ inline Vec3f min(const Vec3f& a, const Vec3f& b)
 
 inline Vec3d operator+(const Vec3d& a, const Vec3d& b) { return makeVec3d(a.x + b.x, a.y + b.y, a.z + b.z); }
 
+inline Vec3d operator-(const Vec3d& a, const Vec3d& b) { return makeVec3d(a.x - b.x, a.y - b.y, a.z - b.z); }
+
 inline Vec3d operator*(const double a, const Vec3d& b) { return makeVec3d(a * b.x, a * b.y, a * b.z); }
 
 
@@ -61,6 +63,8 @@ Mat3f inverse(const Mat3f& M);
 
 Mat3f mul(const Mat3f& A, const Mat3f& B);
 
+Mat3x4f mul(const Mat3x4f& A, const Mat3x4f& B);  // Affine composition, applies B first.
+
 float getScale(const Mat3f& M);
 
 inline float getScale(const Mat3x4f& M) { return getScale(makeMat3f(M.data)); }
@@ -2,6 +2,25 @@
 
 #include "Common.h"
 
-bool parseAtt(Store* store, Logger logger, const void * ptr, size_t size, bool create=false);
+// Byte range of a group in an rvm file or of its block in an att file, to be skipped while
+// parsing. Ranges are sorted and come from an RVMIndex, see RVMIndex.h.
+struct SkipRange
+{
+  uint64_t begin;
+  uint64_t end;
+  uint32_t lines;   // Number of lines in the range of an att file.
+};
 
-bool parseRVM(Store* store, Logger logger, const char* path, const void * ptr, size_t size);
+// Groups in discard are skipped along with their children, the list is only read. Unless
+// create is set, top-level blocks are parsed on multiple threads.
+bool parseAtt(Store* store, Logger logger, const void * ptr, size_t size, bool create=false, const DiscardList* discard=nullptr,
+              const SkipRange* skip=nullptr, size_t skip_n=0, unsigned threads=1);
+
+// If lazyFacetGroups is set, facet groups reference ptr, which must outlive store. Groups in
+// discard are skipped along with their children, and counted in discard->discarded. CNTB
+// chunks starting a range in skip are jumped over without reading them.
+bool parseRVM(Store* store, Logger logger, const char* path, const void * ptr, size_t size, unsigned threads=1, bool lazyFacetGroups=false, DiscardList* discard=nullptr,
+              const SkipRange* skip=nullptr, size_t skip_n=0);
+
+// Polygons of a facet group, decoded into arena if decoding was deferred by parseRVM.
+struct Polygon* facetGroupPolygons(Arena* arena, const struct Geometry* geo);
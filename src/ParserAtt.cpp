@@ -2,6 +2,15 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#define RVMPARSER_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 #include "Parser.h"
 #include "Store.h"
@@ -14,6 +23,20 @@ namespace {
     Node* group;
   };
 
+  // Attribute found and interned by a worker thread, set on the group by the main thread.
+  struct AttributeRecord
+  {
+    Node* group;
+    const char* key;
+    const char* value;
+  };
+
+  struct ChildEntry
+  {
+    const Node* parent;   // Null for root groups.
+    Node* child;
+  };
+
   struct Context
   {
     Store* store;
@@ -29,9 +52,89 @@ namespace {
     unsigned stack_p = 0;
     unsigned stack_c = 0;
 
+    // Children of (parent, name), filled for a parent on its first lookup, as scanning for
+    // each NEW-tag is quadratic in the number of siblings.
+    Arena arena;
+    Map children;
+    Map indexedParents;
+    unsigned skip = 0;    // Depth inside a discarded group, its lines are not parsed.
+
+    const DiscardList* discard = nullptr;
+    const SkipRange* skipRanges = nullptr;
+    size_t skipRanges_n = 0;
+
+    // Set on worker threads, which must not modify groups. Names are looked up without
+    // interning and attributes are recorded instead of set.
+    std::vector<AttributeRecord>* records = nullptr;
     bool create;
   };
 
+  void silentLogger(unsigned, const char*, ...) {}
+
+  uint64_t childKey(const Node* parent, const char* name)
+  {
+    uint64_t key = uint64_t(parent) * 0x9E3779B97F4A7C15ull ^ uint64_t(name);
+    return key ? key : 1;
+  }
+
+  void indexChild(Context* ctx, const Node* parent, Node* child)
+  {
+    const uint64_t key = childKey(parent, child->group.name);
+    auto * entry = (ChildEntry*)ctx->children.get(key);
+    if (entry && entry->parent == parent && entry->child->group.name == child->group.name) return;  // Keep first.
+
+    entry = ctx->arena.alloc<ChildEntry>();
+    entry->parent = parent;
+    entry->child = child;
+    ctx->children.insert(key, uint64_t(entry));
+  }
+
+  // Same result as a scan of parent's children, or of the root groups if parent is null.
+  // Short lists of children are scanned, longer ones are indexed on the first miss.
+  Node* findChild(Context* ctx, const Node* parent, const char* name)
+  {
+    const uint64_t parentKey = parent ? uint64_t(parent) : 1;
+    if (ctx->indexedParents.get(parentKey) == 0) {
+      if (parent) {
+        unsigned n = 0;
+        for (auto * child = parent->children.first; child && n < 32; child = child->next, n++) {
+          if (child->group.name == name) return child;
+        }
+        if (n < 32) return nullptr;
+
+        for (auto * child = parent->children.first; child; child = child->next) {
+          indexChild(ctx, parent, child);
+        }
+      }
+      else {
+        for (auto * file = ctx->store->getFirstRoot(); file; file = file->next) {
+          for (auto * model = file->children.first; model; model = model->next) {
+            for (auto * group = model->children.first; group; group = group->next) {
+              indexChild(ctx, nullptr, group);
+            }
+          }
+        }
+      }
+      ctx->indexedParents.insert(parentKey, 1);
+    }
+
+    auto * entry = (const ChildEntry*)ctx->children.get(childKey(parent, name));
+    if (entry && entry->parent == parent && entry->child->group.name == name) {
+      return entry->child;
+    }
+    if (entry) {
+      // Key collision, the entry of one of the two was overwritten.
+      if (parent) {
+        for (auto * child = parent->children.first; child; child = child->next) {
+          if (child->group.name == name) return child;
+        }
+        return nullptr;
+      }
+      return ctx->store->findRootGroup(name);
+    }
+    return nullptr;
+  }
+
   bool handleNew(Context* ctx, const char* id_a, const char* id_b)
   {
     if (ctx->stack_c <= ctx->stack_p + 1) {
@@ -39,17 +142,22 @@ namespace {
       ctx->stack = (StackItem*)xrealloc(ctx->stack, sizeof(StackItem) * ctx->stack_c);
     }
 
-    auto * id = ctx->store->strings.intern(id_a, id_b);
+    // Names of groups are interned, so an id that is not cannot match a group.
+    auto * id = ctx->records ? ctx->store->strings.find(id_a, id_b) : ctx->store->strings.intern(id_a, id_b);
 
     Node * group = nullptr;
-    if (ctx->stack_p == 0) {
+    if (id == nullptr) {
+      assert(ctx->records);
+    }
+    else if (ctx->stack_p == 0) {
 
       if (id != ctx->headerInfo) {
-        group = ctx->store->findRootGroup(id);
+        group = findChild(ctx, nullptr, id);
         if (ctx->create && group == nullptr) {
           auto * model = ctx->store->getDefaultModel();
           group = ctx->store->newNode(model, Node::Kind::Group);
           group->group.name = id;
+          indexChild(ctx, nullptr, group);
           //ctx->logger(1, "@%d: Failed to find root group '%s' id=%p", ctx->line, id, id);
         }
       }
@@ -58,22 +166,17 @@ namespace {
 
       auto * parent = ctx->stack[ctx->stack_p - 1].group;
       if (parent) {
-        for (auto * child = parent->children.first; child; child = child->next) {
-          if (child->group.name == id) {
-            group = child;
-            break;
-          }
-        }
+        group = findChild(ctx, parent, id);
       }
       if (ctx->create && group == nullptr) {
         group = ctx->store->newNode(parent, Node::Kind::Group);
         group->group.name = id;
+        if (parent && ctx->indexedParents.get(uint64_t(parent))) indexChild(ctx, parent, group);
         //ctx->logger(1, "@%d: Failed to find child group '%s' id=%p", ctx->line, id, id);
       }
     }
 
     //ctx->logger(0, "@%d: new '%s'", ctx->line, id);
-    assert(id);
     ctx->stack[ctx->stack_p++] = { id, group };
     return true;
   }
@@ -89,6 +192,15 @@ namespace {
     return true;
   }
 
+  void setAttribute(Store* store, Node* grp, const char* key, const char* value)
+  {
+    auto * att = store->getAttribute(grp, key);
+    if (att == nullptr) {
+      att = store->newAttribute(grp, key);
+    }
+    att->val = value;
+  }
+
   bool handleAttribute(Context* ctx, const char* key_a, const char* key_b, const char* value_a, const char* value_b)
   {
     assert(ctx->stack_p);
@@ -96,23 +208,41 @@ namespace {
     if (grp == nullptr) return true; // Inside skipped group like headerinfo
 
     auto * key = ctx->store->strings.intern(key_a, key_b);
-    auto * att = ctx->store->getAttribute(grp, key);
-    if (att == nullptr) {
-      att = ctx->store->newAttribute(grp, key);
+    auto * value = ctx->store->strings.intern(value_a, value_b);
+    if (ctx->records) {
+      ctx->records->push_back(AttributeRecord{ grp, key, value });
+      return true;
     }
-    att->val = ctx->store->strings.intern(value_a, value_b);
+
+    setAttribute(ctx->store, grp, key, value);
 
     //ctx->logger(0, "@%d: att ('%s', '%s')", ctx->line, key, value);
     return true;
   }
 
 
-  const char* getEndOfLine(const char* p, const char* end)
+  // Returns the first newline or c at or after p, or end. Scans 16 bytes at a time if possible.
+  const char* findNewlineOr(const char* p, const char* end, char c)
   {
-    while (p < end && (*p != '\n' && *p != '\r'))  p++;
+#ifdef RVMPARSER_USE_SSE2
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i cc = _mm_set1_epi8(c);
+    for (; 16 <= end - p; p += 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, nl), _mm_cmpeq_epi8(x, cr)), _mm_cmpeq_epi8(x, cc));
+      if (unsigned mask = unsigned(_mm_movemask_epi8(m))) return p + std::countr_zero(mask);
+    }
+#endif
+    while (p < end && (*p != '\n' && *p != '\r' && *p != c)) p++;
     return p;
   }
 
+  const char* getEndOfLine(const char* p, const char* end)
+  {
+    return findNewlineOr(p, end, '\n');
+  }
+
   const char* skipEndOfLine(const char* p, const char* end)
   {
     while (p < end && (*p == '\n' || *p == '\r'))  p++;
@@ -135,6 +265,20 @@ namespace {
   {
     spaces = 0;
     tabs = 0;
+#ifdef RVMPARSER_USE_SSE2
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    for (; 16 <= end - p; p += 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      unsigned s = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(x, sp)));
+      unsigned t = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(x, tab)));
+      unsigned n = unsigned(std::countr_one(s | t));  // Length of the run of blanks, at most 16.
+      unsigned run = (1u << n) - 1u;
+      spaces += unsigned(std::popcount(s & run));
+      tabs += unsigned(std::popcount(t & run));
+      if (n < 16) return p + n;
+    }
+#endif
     for (; p < end; p++) {
       if (*p == ' ') spaces++;
       else if (*p == '\t') tabs++;
@@ -145,18 +289,16 @@ namespace {
 
   const char* findAssign(const char* p, const char* end)
   {
-    for (; p < end; p++) {
-      if (*p == '\r' || *p == '\n') return p;
-      if (p+1 < end && (p[0] == ':' && p[1] == '=')) return p; 
+    for (; (p = findNewlineOr(p, end, ':')) < end && *p == ':'; p++) {
+      if (p + 1 < end && p[1] == '=') return p;
     }
     return p;
   }
 
   const char* findSep(const char* p, const char* end)
   {
-    for (; p < end; p++) {
-      if (*p == '\r' || *p == '\n') return p;
-      if (p + 4 < end && (p[0] == '&' && p[1] == 'e' && p[2] == 'n' && p[3] == 'd' && p[4] == '&')) return p;
+    for (; (p = findNewlineOr(p, end, '&')) < end && *p == '&'; p++) {
+      if (p + 4 < end && (p[1] == 'e' && p[2] == 'n' && p[3] == 'd' && p[4] == '&')) return p;
     }
     return p;
   }
@@ -172,70 +314,193 @@ namespace {
   }
 
 
-}
+  // Parse lines from p up to end, which are at line ctx->line of the file starting at base.
+  bool parseLines(Context* ctx, const char* base, const char* p, const char* end)
+  {
+    for (; p < end; ctx->line++) {
+      // Skip ranges are sorted, so they are consumed in order.
+      while (ctx->skipRanges_n && ctx->skipRanges->begin < size_t(p - base)) {
+        ctx->skipRanges++;
+        ctx->skipRanges_n--;
+      }
+      if (ctx->skipRanges_n && ctx->skipRanges->begin == size_t(p - base) && base + ctx->skipRanges->end <= end && ctx->skipRanges->lines) {
+        p = base + ctx->skipRanges->end;
+        ctx->line += ctx->skipRanges->lines - 1;
+        continue;
+      }
 
+      p = parseIndentation(ctx->spaces, ctx->tabs, p, end);
+      if (ctx->skip) {
+        if (matchNew(p, end)) ctx->skip++;
+        else if (matchEnd(p, end)) ctx->skip--;
+        p = getEndOfLine(p, end);
+      }
+      else if (matchNew(p, end)) {
+        auto * a = skipSpace(p + 4, end);
+        p = getEndOfLine(a, end);
+        auto * b = reverseSkipSpace(a, p);
+        if (ctx->discard && ctx->discard->names.find(a, b)) {
+          ctx->skip = 1;
+        }
+        else if (!handleNew(ctx, a, b)) return false;
+      }
+      else if (matchEnd(p, end)) {
+        if (!handleEnd(ctx)) return false;
+        p = getEndOfLine(p, end);
+      }
+      else {
+        while (true) {
+          auto * key_a = p;
+          p = findAssign(p, end);
+          if (p == end || p[0] != ':') {
+            ctx->logger(2, "@%d: Failed to find ':=' token.\n", ctx->line);
+            return false;
+          }
+          auto * key_b = reverseSkipSpace(key_a, p);
+          p = skipSpace(p + 2, end);
+
+          auto * value_a = p;
+          p = findSep(p, end);
+          auto * value_b = reverseSkipSpace(value_a, p);
+          if (2 <= (value_b-value_a) && value_a[0] == '\'' && value_b[-1] == '\'') {
+            value_a++;
+            value_b--;
+          }
+          if (!handleAttribute(ctx, key_a, key_b, value_a, value_b)) return false;
 
-bool parseAtt(class Store* store, Logger logger, const void * ptr, size_t size, bool create)
-{
-  char buf[1024];
-  Context ctx = { store, logger, store->strings.intern("Header Information"), buf, sizeof(buf) };
+          if (p + 5 < end && p[0] == '&') {
+            p = skipSpace(p + 5, end);
+          }
+          else {
+            break;
+          }
+        }
+      }
+      if ((p < end) && (*p != '\n' && *p != '\r')) {
+        ctx->logger(2, "@%d: Line scanning did not terminate at end of line", ctx->line);
+        return false;
+      }
+      p = skipEndOfLine(p, end);
+    }
+    return true;
+  }
 
-  ctx.stack_c = 1024;
-  ctx.stack = (StackItem*)xmalloc(sizeof(StackItem) * ctx.stack_c);
-  ctx.create = create;
 
-  auto * p = (const char*)(ptr);
+  // A run of top-level NEW...END blocks parsed by a worker thread.
+  struct AttTask
+  {
+    const char* begin;
+    const char* end;
+    unsigned line;
+    std::vector<AttributeRecord> records;
+    bool success = false;
+  };
+
+  // Split lines from p into runs of top-level blocks of roughly equal size, counting lines
+  // like parseLines. Fails if anything but blocks are found at the top level.
+  bool splitTopLevelBlocks(std::vector<AttTask>& tasks, const char* p, const char* end, unsigned threads)
+  {
+    const size_t taskSize = size_t(end - p) / (4 * threads) + 1;
+    const char* taskBegin = p;
+    unsigned taskLine = 1;
+    unsigned depth = 0;
+    for (unsigned line = 1; p < end; line++) {
+      const char* q = skipSpace(p, end);
+      if (matchNew(q, end)) {
+        if (depth == 0 && taskSize <= size_t(p - taskBegin)) {
+          tasks.push_back(AttTask{ taskBegin, p, taskLine });
+          taskBegin = p;
+          taskLine = line;
+        }
+        depth++;
+      }
+      else if (matchEnd(q, end)) {
+        if (depth == 0) return false;
+        depth--;
+      }
+      else if (depth == 0) {
+        return false;
+      }
+      p = skipEndOfLine(getEndOfLine(q, end), end);
+    }
+    if (depth != 0) return false;
+    tasks.push_back(AttTask{ taskBegin, end, taskLine });
+    return true;
+  }
+
+}
+
+
+bool parseAtt(class Store* store, Logger logger, const void * ptr, size_t size, bool create, const DiscardList* discard,
+              const SkipRange* skip, size_t skip_n, unsigned threads)
+{
+  auto * base = (const char*)(ptr);
+  auto * p = base;
   auto * end = p + size;
   p = getEndOfLine(p, end);
   p = skipEndOfLine(p, end);
 
-  for (ctx.line = 1; p < end; ctx.line++) {
-    p = parseIndentation(ctx.spaces, ctx.tabs, p, end);
-    if (matchNew(p, end)) {
-      auto * a = skipSpace(p + 4, end);
-      p = getEndOfLine(a, end);
-      if (!handleNew(&ctx, a, reverseSkipSpace(a, p))) goto error;
-    }
-    else if (matchEnd(p, end)) {
-      if (!handleEnd(&ctx)) goto error;
-      p = getEndOfLine(p, end);
-    }
-    else {
-      while (true) {
-        auto * key_a = p;
-        p = findAssign(p, end);
-        if (p == end || p[0] != ':') {
-          logger(2, "@%d: Failed to find ':=' token.\n", ctx.line);
-          goto error;
-        }
-        auto * key_b = reverseSkipSpace(key_a, p);
-        p = skipSpace(p + 2, end);
-
-        auto * value_a = p;
-        p = findSep(p, end);
-        auto * value_b = reverseSkipSpace(value_a, p);
-        if (2 <= (value_b-value_a) && value_a[0] == '\'' && value_b[-1] == '\'') {
-          value_a++;
-          value_b--;
+  const char* headerInfo = store->strings.intern("Header Information");
+
+  // Groups are not created while parsing in parallel, as worker threads only look them up.
+  if (1 < threads && !create) {
+    std::vector<AttTask> tasks;
+    if (splitTopLevelBlocks(tasks, p, end, threads) && 1 < tasks.size()) {
+      std::atomic<size_t> next = 0;
+      std::atomic<bool> abort = false;
+      auto worker = [&]() {
+        for (size_t i = next++; i < tasks.size() && !abort; i = next++) {
+          auto& task = tasks[i];
+          char buf[1024];
+          Context ctx = { store, silentLogger, headerInfo, buf, sizeof(buf) };
+          ctx.stack_c = 1024;
+          ctx.stack = (StackItem*)xmalloc(sizeof(StackItem) * ctx.stack_c);
+          ctx.create = false;
+          ctx.discard = discard;
+          ctx.skipRanges = skip;
+          ctx.skipRanges_n = skip_n;
+          ctx.records = &task.records;
+          ctx.line = task.line;
+          task.success = parseLines(&ctx, base, task.begin, task.end) && ctx.stack_p == 0 && ctx.skip == 0;
+          free(ctx.stack);
+          if (!task.success) abort = true;
         }
-        if (!handleAttribute(&ctx, key_a, key_b, value_a, value_b)) goto error;
+      };
+      std::vector<std::thread> workers;
+      for (size_t i = 0; i < std::min(size_t(threads), tasks.size()); i++) {
+        workers.emplace_back(worker);
+      }
+      for (auto& worker : workers) {
+        worker.join();
+      }
 
-        if (p + 5 < end && p[0] == '&') {
-          p = skipSpace(p + 5, end);
-        }
-        else {
-          break;
+      // On errors, parse single-threaded below to report the first one.
+      if (!abort) {
+        for (const auto& task : tasks) {
+          for (const auto& record : task.records) {
+            setAttribute(store, record.group, record.key, record.value);
+          }
         }
+        store->updateCounts();
+        return true;
       }
     }
-    if ((p < end) && (*p != '\n' && *p != '\r')) {
-      logger(2, "@%d: Line scanning did not terminate at end of line", ctx.line);
-      goto error;
-    }
-    p = skipEndOfLine(p, end);
   }
 
-  if (ctx.stack_p != 0) {
+  char buf[1024];
+  Context ctx = { store, logger, headerInfo, buf, sizeof(buf) };
+
+  ctx.stack_c = 1024;
+  ctx.stack = (StackItem*)xmalloc(sizeof(StackItem) * ctx.stack_c);
+  ctx.create = create;
+  ctx.discard = discard;
+  ctx.skipRanges = skip;
+  ctx.skipRanges_n = skip_n;
+
+  ctx.line = 1;
+  if (!parseLines(&ctx, base, p, end)) goto error;
+
+  if (ctx.stack_p != 0 || ctx.skip != 0) {
     logger(2, "@%d: More NEW-tags and than END-tags.", ctx.line);
     return false;
   }
@@ -6,10 +6,22 @@
 #include <string>
 #include <cstdio>
 #include <cctype>
+#include <cstring>
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 
 #include <cassert>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#define RVMPARSER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "LinAlgOps.h"
 
 namespace {
@@ -17,10 +29,15 @@ namespace {
   struct Context
   {
     Store* store;
+    StringInterning* strings;   // Interning of the output store, also used by parse tasks.
     Logger logger;
     char* buf;
     size_t buf_size;
     std::vector<Node*> group_stack;
+    bool lazyFacetGroups = false;
+    DiscardList* discard = nullptr;
+    const SkipRange* skip = nullptr;
+    size_t skip_n = 0;
   };
 
   const char* read_uint8(uint8_t& rv, const char* curr_ptr, const char* /*end_ptr*/)
@@ -50,12 +67,123 @@ namespace {
     return curr_ptr + 4;
   }
 
+#ifdef RVMPARSER_USE_SSE2
+
+  // Reverse the byte order of each 32-bit lane.
+  __m128 byteswap_epi32(__m128i x)
+  {
+    x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_castsi128_ps(x);
+  }
+
+  __m128 load_float32x4_be(const char* ptr)
+  {
+    return byteswap_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)));
+  }
+
+#endif
+
+  const char* read_float32_be(float* dst, size_t n, const char* curr_ptr, const char* end_ptr)
+  {
+    size_t i = 0;
+#ifdef RVMPARSER_USE_SSE2
+    for (; i + 4 <= n; i += 4) {
+      _mm_storeu_ps(dst + i, load_float32x4_be(curr_ptr));
+      curr_ptr += 4 * sizeof(float);
+    }
+#endif
+    for (; i < n; i++) {
+      curr_ptr = read_float32_be(dst[i], curr_ptr, end_ptr);
+    }
+    return curr_ptr;
+  }
+
+  // Decode n vertices of interleaved big-endian position and normal into separate arrays.
+  const char* read_vertices_normals_be(float* vertices, float* normals, size_t n, const char* curr_ptr, const char* end_ptr)
+  {
+    size_t i = 0;
+#ifdef RVMPARSER_USE_SSE2
+    // Four vertices per iteration, that is, six registers in and three out for each array.
+    for (; i + 4 <= n; i += 4) {
+      __m128 r0 = load_float32x4_be(curr_ptr + 0 * 16);   // p0x p0y p0z n0x
+      __m128 r1 = load_float32x4_be(curr_ptr + 1 * 16);   // n0y n0z p1x p1y
+      __m128 r2 = load_float32x4_be(curr_ptr + 2 * 16);   // p1z n1x n1y n1z
+      __m128 r3 = load_float32x4_be(curr_ptr + 3 * 16);   // p2x p2y p2z n2x
+      __m128 r4 = load_float32x4_be(curr_ptr + 4 * 16);   // n2y n2z p3x p3y
+      __m128 r5 = load_float32x4_be(curr_ptr + 5 * 16);   // p3z n3x n3y n3z
+      curr_ptr += 6 * 16;
+
+      __m128 t0 = _mm_shuffle_ps(r0, r1, _MM_SHUFFLE(2, 2, 2, 2));                         // p0z p0z p1x p1x
+      __m128 t1 = _mm_shuffle_ps(r1, r2, _MM_SHUFFLE(0, 0, 3, 3));                         // p1y p1y p1z p1z
+      __m128 t2 = _mm_shuffle_ps(r3, r4, _MM_SHUFFLE(3, 2, 2, 2));                         // p2z p2z p3x p3y
+      __m128 t3 = _mm_shuffle_ps(r4, r5, _MM_SHUFFLE(0, 0, 3, 3));                         // p3y p3y p3z p3z
+      _mm_storeu_ps(vertices + 3 * i + 0, _mm_shuffle_ps(r0, t0, _MM_SHUFFLE(2, 0, 1, 0)));  // p0x p0y p0z p1x
+      _mm_storeu_ps(vertices + 3 * i + 4, _mm_shuffle_ps(t1, r3, _MM_SHUFFLE(1, 0, 2, 0)));  // p1y p1z p2x p2y
+      _mm_storeu_ps(vertices + 3 * i + 8, _mm_shuffle_ps(t2, t3, _MM_SHUFFLE(2, 0, 2, 0)));  // p2z p3x p3y p3z
+
+      __m128 u0 = _mm_shuffle_ps(r0, r1, _MM_SHUFFLE(0, 0, 3, 3));                         // n0x n0x n0y n0y
+      __m128 u1 = _mm_shuffle_ps(r1, r2, _MM_SHUFFLE(1, 1, 1, 1));                         // n0z n0z n1x n1x
+      __m128 u2 = _mm_shuffle_ps(r3, r4, _MM_SHUFFLE(0, 0, 3, 3));                         // n2x n2x n2y n2y
+      __m128 u3 = _mm_shuffle_ps(r4, r5, _MM_SHUFFLE(1, 1, 1, 1));                         // n2z n2z n3x n3x
+      _mm_storeu_ps(normals + 3 * i + 0, _mm_shuffle_ps(u0, u1, _MM_SHUFFLE(2, 0, 2, 0)));   // n0x n0y n0z n1x
+      _mm_storeu_ps(normals + 3 * i + 4, _mm_shuffle_ps(r2, u2, _MM_SHUFFLE(2, 0, 3, 2)));   // n1y n1z n2x n2y
+      _mm_storeu_ps(normals + 3 * i + 8, _mm_shuffle_ps(u3, r5, _MM_SHUFFLE(3, 2, 2, 0)));   // n2z n3x n3y n3z
+    }
+#endif
+    // All of a triangle takes this path, where single reads beat the bulk read.
+    for (; i < n; i++) {
+      for (unsigned k = 0; k < 3; k++) curr_ptr = read_float32_be(vertices[3 * i + k], curr_ptr, end_ptr);
+      for (unsigned k = 0; k < 3; k++) curr_ptr = read_float32_be(normals[3 * i + k], curr_ptr, end_ptr);
+    }
+    return curr_ptr;
+  }
+
+  const char* read_facet_group(Arena* arena, Polygon*& polygons, uint32_t polygons_n, const char* curr_ptr, const char* end_ptr)
+  {
+    polygons = (Polygon*)arena->alloc(sizeof(Polygon)*polygons_n);
+
+    for (unsigned pi = 0; pi < polygons_n; pi++) {
+      auto & poly = polygons[pi];
+
+      curr_ptr = read_uint32_be(poly.contours_n, curr_ptr, end_ptr);
+      poly.contours = (Contour*)arena->alloc(sizeof(Contour)*poly.contours_n);
+      for (unsigned gi = 0; gi < poly.contours_n; gi++) {
+        auto & cont = poly.contours[gi];
+
+        curr_ptr = read_uint32_be(cont.vertices_n, curr_ptr, end_ptr);
+
+        // Vertices and normals share a single allocation.
+        cont.vertices = (float*)arena->alloc(6 * sizeof(float)*cont.vertices_n);
+        cont.normals = cont.vertices ? cont.vertices + 3 * cont.vertices_n : nullptr;
+        curr_ptr = read_vertices_normals_be(cont.vertices, cont.normals, cont.vertices_n, curr_ptr, end_ptr);
+      }
+    }
+    return curr_ptr;
+  }
+
+  // Step past the facet group data, only reading the counts.
+  const char* skip_facet_group(uint32_t polygons_n, const char* curr_ptr, const char* end_ptr)
+  {
+    for (unsigned pi = 0; pi < polygons_n && curr_ptr + 4 <= end_ptr; pi++) {
+      uint32_t contours_n;
+      curr_ptr = read_uint32_be(contours_n, curr_ptr, end_ptr);
+      for (unsigned gi = 0; gi < contours_n && curr_ptr + 4 <= end_ptr; gi++) {
+        uint32_t vertices_n;
+        curr_ptr = read_uint32_be(vertices_n, curr_ptr, end_ptr);
+        curr_ptr += 6 * sizeof(float) * size_t(vertices_n);
+      }
+    }
+    return curr_ptr;
+  }
+
   constexpr uint32_t id(const char* str)
   {
     return str[3] << 24 | str[2] << 16 | str[1] << 8 | str[0];
   }
 
-  const char* read_string(const char** dst, Store* store, const char* curr_ptr, const char* end_ptr)
+  const char* read_string(const char** dst, StringInterning* strings, const char* curr_ptr, const char* end_ptr)
   {
     uint32_t len;
     curr_ptr = read_uint32_be(len, curr_ptr, end_ptr);
@@ -67,7 +195,7 @@ namespace {
         break;
       }
     }
-    *dst = store->strings.intern(curr_ptr, curr_ptr + l);
+    *dst = strings->intern(curr_ptr, curr_ptr + l);
     return curr_ptr + 4 * len;
   }
 
@@ -97,6 +225,24 @@ namespace {
     return curr_ptr;
   }
 
+  // Pointer to an absolute chunk offset. Offsets are stored as 32 bits and wrap around in
+  // files larger than 4GB, so step relative to the current position.
+  const char* offset_ptr(const char* base_ptr, const char* curr_ptr, uint32_t offset)
+  {
+    return curr_ptr + static_cast<uint32_t>(offset - static_cast<uint32_t>(curr_ptr - base_ptr));
+  }
+
+  // Check that a chunk header fits and that its id looks like one, as the parser asserts
+  // on ids when following offsets that are not verified against the contents.
+  bool is_chunk_header(const char* curr_ptr, const char* end_ptr)
+  {
+    if (end_ptr < curr_ptr + 6 * 4) return false;
+    for (unsigned i = 0; i < 4; i++) {
+      if (curr_ptr[4 * i] != 0 || curr_ptr[4 * i + 1] != 0 || curr_ptr[4 * i + 2] != 0) return false;
+    }
+    return true;
+  }
+
   bool verifyOffset(Context* ctx, const char* chunk_type, const char* base_ptr, const char* curr_ptr, uint32_t expected_next_chunk_offset)
   {
     size_t current_offset = curr_ptr - base_ptr;
@@ -119,17 +265,17 @@ namespace {
 
     uint32_t version;
     curr_ptr = read_uint32_be(version, curr_ptr, end_ptr);
-    curr_ptr = read_string(&g->file.info, ctx->store, curr_ptr, end_ptr);
-    curr_ptr = read_string(&g->file.note, ctx->store, curr_ptr, end_ptr);
-    curr_ptr = read_string(&g->file.date, ctx->store, curr_ptr, end_ptr);
-    curr_ptr = read_string(&g->file.user, ctx->store, curr_ptr, end_ptr);
+    curr_ptr = read_string(&g->file.info, ctx->strings, curr_ptr, end_ptr);
+    curr_ptr = read_string(&g->file.note, ctx->strings, curr_ptr, end_ptr);
+    curr_ptr = read_string(&g->file.date, ctx->strings, curr_ptr, end_ptr);
+    curr_ptr = read_string(&g->file.user, ctx->strings, curr_ptr, end_ptr);
     if (2 <= version) {
-      curr_ptr = read_string(&g->file.encoding, ctx->store, curr_ptr, end_ptr);
+      curr_ptr = read_string(&g->file.encoding, ctx->strings, curr_ptr, end_ptr);
     }
     else {
-      g->file.encoding = ctx->store->strings.intern("");
+      g->file.encoding = ctx->strings->intern("");
     }
-    g->file.path = ctx->store->strings.intern(path);
+    g->file.path = ctx->strings->intern(path);
 
     if (!verifyOffset(ctx, "HEAD", base_ptr, curr_ptr, expected_next_chunk_offset)) return nullptr;
 
@@ -145,8 +291,8 @@ namespace {
     uint32_t version;
     curr_ptr = read_uint32_be(version, curr_ptr, end_ptr);
 
-    curr_ptr = read_string(&g->model.project, ctx->store, curr_ptr, end_ptr);
-    curr_ptr = read_string(&g->model.name, ctx->store, curr_ptr, end_ptr);
+    curr_ptr = read_string(&g->model.project, ctx->strings, curr_ptr, end_ptr);
+    curr_ptr = read_string(&g->model.name, ctx->strings, curr_ptr, end_ptr);
 
     //fprintf(stderr, "modl project='%s', name='%s'\n", g->model.project, g->model.name);
 
@@ -170,12 +316,8 @@ namespace {
 
     auto * g = ctx->store->newGeometry(ctx->group_stack.back());
 
-    for (unsigned i = 0; i < 12; i++) {
-      curr_ptr = read_float32_be(g->M_3x4.data[i], curr_ptr, end_ptr);
-    }
-    for (unsigned i = 0; i < 6; i++) {
-      curr_ptr = read_float32_be(g->bboxLocal.data[i], curr_ptr, end_ptr);
-    }
+    curr_ptr = read_float32_be(g->M_3x4.data, 12, curr_ptr, end_ptr);
+    curr_ptr = read_float32_be(g->bboxLocal.data, 6, curr_ptr, end_ptr);
     g->bboxWorld = transform(g->M_3x4, g->bboxLocal);
 
     bool hasTransparency = false;
@@ -290,29 +432,14 @@ namespace {
       g->kind = Geometry::Kind::FacetGroup;
 
       curr_ptr = read_uint32_be(g->facetGroup.polygons_n, curr_ptr, end_ptr);
-      g->facetGroup.polygons = (Polygon*)ctx->store->arena.alloc(sizeof(Polygon)*g->facetGroup.polygons_n);
-
-      for (unsigned pi = 0; pi < g->facetGroup.polygons_n; pi++) {
-        auto & poly = g->facetGroup.polygons[pi];
-
-        curr_ptr = read_uint32_be(poly.contours_n, curr_ptr, end_ptr);
-        poly.contours = (Contour*)ctx->store->arena.alloc(sizeof(Contour)*poly.contours_n);
-        for (unsigned gi = 0; gi < poly.contours_n; gi++) {
-          auto & cont = poly.contours[gi];
-
-          curr_ptr = read_uint32_be(cont.vertices_n, curr_ptr, end_ptr);
-          cont.vertices = (float*)ctx->store->arena.alloc(3 * sizeof(float)*cont.vertices_n);
-          cont.normals = (float*)ctx->store->arena.alloc(3 * sizeof(float)*cont.vertices_n);
-
-          for (unsigned vi = 0; vi < cont.vertices_n; vi++) {
-            for (unsigned i = 0; i < 3; i++) {
-              curr_ptr = read_float32_be(cont.vertices[3 * vi + i], curr_ptr, end_ptr);
-            }
-            for (unsigned i = 0; i < 3; i++) {
-              curr_ptr = read_float32_be(cont.normals[3 * vi + i], curr_ptr, end_ptr);
-            }
-          }
-        }
+      if (ctx->lazyFacetGroups) {
+        g->facetGroup.polygons = nullptr;
+        g->facetGroup.encoded = curr_ptr;
+        curr_ptr = skip_facet_group(g->facetGroup.polygons_n, curr_ptr, end_ptr);
+      }
+      else {
+        g->facetGroup.encoded = nullptr;
+        curr_ptr = read_facet_group(&ctx->store->arena, g->facetGroup.polygons, g->facetGroup.polygons_n, curr_ptr, end_ptr);
       }
       break;
 
@@ -327,7 +454,7 @@ namespace {
     return curr_ptr;
   }
 
-  const char* parse_cntb(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset)
+  const char* parse_cntb_header(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset)
   {
     assert(!ctx->group_stack.empty());
     Node* parent = ctx->group_stack.back();
@@ -343,7 +470,7 @@ namespace {
 
     uint32_t version;
     curr_ptr = read_uint32_be(version, curr_ptr, end_ptr);
-    curr_ptr = read_string(&g->group.name, ctx->store, curr_ptr, end_ptr);
+    curr_ptr = read_string(&g->group.name, ctx->strings, curr_ptr, end_ptr);
 
     // Translation seems to be a reference point that can be used as a local frame for objects in the group.
     // The transform is not relative to this reference point.
@@ -371,6 +498,97 @@ namespace {
 
     if (!verifyOffset(ctx, "CNTB", base_ptr, curr_ptr, expected_next_chunk_offset)) return nullptr;
 
+    return curr_ptr;
+  }
+
+  // The range in skip that starts at offset, if any.
+  const SkipRange* find_skip(const SkipRange* skip, size_t skip_n, size_t offset)
+  {
+    auto * it = std::lower_bound(skip, skip + skip_n, offset, [](const SkipRange& range, size_t offset) { return range.begin < offset; });
+    return (it != skip + skip_n && it->begin == offset) ? it : nullptr;
+  }
+
+  // Check the name of a CNTB chunk against the discard list without interning it.
+  bool is_discarded(const DiscardList* discard, const char* curr_ptr, const char* end_ptr)
+  {
+    if (discard == nullptr) return false;
+
+    uint32_t version, len;
+    curr_ptr = read_uint32_be(version, curr_ptr, end_ptr);
+    curr_ptr = read_uint32_be(len, curr_ptr, end_ptr);
+
+    unsigned l = 4 * len;
+    for (unsigned i = 0; i < l; i++) {
+      if (curr_ptr[i] == 0) {
+        l = i;
+        break;
+      }
+    }
+    return discard->names.find(curr_ptr, curr_ptr + l) != nullptr;
+  }
+
+  // Jump past a CNTB chunk and its children by following the chunk offsets.
+  const char* skip_cntb(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset)
+  {
+    char chunk_id[5] = { 0, 0, 0, 0, 0 };
+    uint32_t dunno;
+    unsigned depth = 1;
+    curr_ptr = offset_ptr(base_ptr, curr_ptr, expected_next_chunk_offset);
+    while (depth != 0) {
+      if (!is_chunk_header(curr_ptr, end_ptr)) {
+        snprintf(ctx->buf, ctx->buf_size, "In discarded CNTB, invalid chunk at offset %#zx", size_t(curr_ptr - base_ptr));
+        ctx->store->setErrorString(ctx->buf);
+        return nullptr;
+      }
+      curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+      const char* next_ptr = offset_ptr(base_ptr, curr_ptr, expected_next_chunk_offset);
+      switch (id(chunk_id)) {
+      case id("CNTB"):
+        depth++;
+        break;
+      case id("PRIM"): [[fallthrough]];
+      case id("OBST"): [[fallthrough]];
+      case id("INSU"):
+        break;
+      case id("CNTE"):
+        depth--;
+        next_ptr = curr_ptr + 4;
+        break;
+      default:
+        snprintf(ctx->buf, ctx->buf_size, "In discarded CNTB, unknown chunk id %s", chunk_id);
+        ctx->store->setErrorString(ctx->buf);
+        return nullptr;
+      }
+      if (next_ptr < curr_ptr || end_ptr < next_ptr) {
+        snprintf(ctx->buf, ctx->buf_size, "In discarded CNTB, chunk %s has invalid offset %#x", chunk_id, expected_next_chunk_offset);
+        ctx->store->setErrorString(ctx->buf);
+        return nullptr;
+      }
+      curr_ptr = next_ptr;
+    }
+    ctx->discard->discarded++;
+    return curr_ptr;
+  }
+
+  const char* parse_cntb(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset)
+  {
+    if (const SkipRange* range = find_skip(ctx->skip, ctx->skip_n, size_t(curr_ptr - base_ptr) - 6 * 4)) {
+      if (size_t(end_ptr - base_ptr) < range->end || !is_chunk_header(base_ptr + range->end, end_ptr)) {
+        snprintf(ctx->buf, ctx->buf_size, "Skipped range %#llx-%#llx does not end at a chunk",
+                 static_cast<unsigned long long>(range->begin), static_cast<unsigned long long>(range->end));
+        ctx->store->setErrorString(ctx->buf);
+        return nullptr;
+      }
+      return base_ptr + range->end;
+    }
+
+    if (is_discarded(ctx->discard, curr_ptr, end_ptr)) {
+      return skip_cntb(ctx, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
+    }
+
+    curr_ptr = parse_cntb_header(ctx, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
+    if (curr_ptr == nullptr) return nullptr;
+
     // process children
     char chunk_id[5] = { 0, 0, 0, 0, 0 };
     auto l = curr_ptr;
@@ -429,16 +647,348 @@ namespace {
     return curr_ptr;
   }
 
+  // Chunk tree structure found by hopping from chunk header to chunk header using
+  // next_chunk_offset, without decoding the chunk contents.
+  struct ScanEntry
+  {
+    enum struct Kind : uint32_t
+    {
+      Group,        // CNTB chunk, range covers the full subtree including CNTE.
+      Geometries,   // Run of consecutive PRIM, OBST and INSU chunks.
+      Color,        // COLR chunk at model level.
+      StrayEnd      // Unbalanced CNTE chunk at model level.
+    };
+    size_t begin;
+    size_t end;
+    Kind kind;
+    uint32_t depth;           // Depth of the parent, where the model level is 0.
+    uint32_t transparency;    // Transparency of the parent.
+  };
+
+  constexpr uint32_t maxScanDepth = 8;
+
+  // Returns false if the file has a structure that the scan doesn't handle, in which case
+  // the file is parsed serially to get proper error reporting.
+  bool scan_chunks(std::vector<ScanEntry>& entries, size_t* groupsAtDepth, const SkipRange* skip, size_t skip_n,
+                   const char* base_ptr, const char* curr_ptr, const char* end_ptr)
+  {
+    constexpr size_t none = ~size_t(0);
+
+    struct OpenGroup
+    {
+      size_t entry;
+      uint32_t transparency;
+    };
+    std::vector<OpenGroup> stack;
+    size_t run = none;
+
+    while (curr_ptr < end_ptr) {
+      if (!is_chunk_header(curr_ptr, end_ptr)) return false;
+
+      const char* chunk_ptr = curr_ptr;
+      const size_t chunk_offset = chunk_ptr - base_ptr;
+
+      char chunk_id[5] = { 0, 0, 0, 0, 0 };
+      uint32_t next_chunk_offset, dunno;
+      curr_ptr = parse_chunk_header(chunk_id, next_chunk_offset, dunno, curr_ptr, end_ptr);
+
+      const char* next_ptr = offset_ptr(base_ptr, chunk_ptr, next_chunk_offset);
+
+      const uint32_t id_chunk_id = id(chunk_id);
+      const uint32_t depth = static_cast<uint32_t>(stack.size());
+      const uint32_t parentTransparency = stack.empty() ? 0 : stack.back().transparency;
+      const bool isGeometry = id_chunk_id == id("PRIM") || id_chunk_id == id("OBST") || id_chunk_id == id("INSU");
+
+      if (!isGeometry && run != none) {
+        entries[run].end = chunk_offset;
+        run = none;
+      }
+
+      switch (id_chunk_id) {
+      case id("CNTB"): {
+        if (const SkipRange* range = find_skip(skip, skip_n, chunk_offset)) {
+          if (size_t(end_ptr - base_ptr) < range->end) return false;
+          curr_ptr = base_ptr + range->end;
+          break;
+        }
+        if (next_ptr < curr_ptr + 4 || end_ptr < next_ptr) return false;
+
+        // The optional transparency field is the last four bytes of the header.
+        uint32_t version;
+        read_uint32_be(version, curr_ptr, end_ptr);
+        uint32_t transparency = 2 < version ? reinterpret_cast<const uint8_t*>(next_ptr)[-4] : parentTransparency;
+
+        size_t entry = none;
+        if (depth <= maxScanDepth) {
+          entry = entries.size();
+          entries.push_back(ScanEntry{ chunk_offset, 0, ScanEntry::Kind::Group, depth, parentTransparency });
+          groupsAtDepth[depth]++;
+        }
+        stack.push_back(OpenGroup{ entry, transparency });
+        curr_ptr = next_ptr;
+        break;
+      }
+      case id("PRIM"): [[fallthrough]];
+      case id("OBST"): [[fallthrough]];
+      case id("INSU"):
+        if (next_ptr <= curr_ptr || end_ptr < next_ptr) return false;
+        if (run == none && depth <= maxScanDepth) {
+          run = entries.size();
+          entries.push_back(ScanEntry{ chunk_offset, 0, ScanEntry::Kind::Geometries, depth, parentTransparency });
+        }
+        curr_ptr = next_ptr;
+        break;
+      case id("CNTE"):
+        if (end_ptr < curr_ptr + 4) return false;
+        curr_ptr += 4;
+        if (stack.empty()) {
+          entries.push_back(ScanEntry{ chunk_offset, size_t(curr_ptr - base_ptr), ScanEntry::Kind::StrayEnd, 0, 0 });
+        }
+        else {
+          if (stack.back().entry != none) {
+            entries[stack.back().entry].end = curr_ptr - base_ptr;
+          }
+          stack.pop_back();
+        }
+        break;
+      case id("COLR"):
+        if (!stack.empty() || next_ptr <= curr_ptr || end_ptr < next_ptr) return false;
+        entries.push_back(ScanEntry{ chunk_offset, size_t(next_ptr - base_ptr), ScanEntry::Kind::Color, 0, 0 });
+        curr_ptr = next_ptr;
+        break;
+      case id("END:"):
+        return stack.empty();
+      default:
+        return false;
+      }
+    }
+    return stack.empty() && run == none;
+  }
+
+  // A run of sibling chunks that is parsed by a worker thread into a store of its own,
+  // below a stand-in for the parent node.
+  struct ParseTask
+  {
+    size_t begin;
+    size_t end;
+    Node parent;
+    Store* store = nullptr;
+    bool done = false;
+    bool success = false;
+  };
+
+  bool parse_task(ParseTask& task, const Context* parent_ctx, const char* base_ptr, const char* end_ptr)
+  {
+    char buf[1024];
+    Context ctx = {
+      .store = task.store,
+      .strings = parent_ctx->strings,
+      .logger = parent_ctx->logger,
+      .buf = buf,
+      .buf_size = sizeof(buf),
+      .lazyFacetGroups = parent_ctx->lazyFacetGroups,
+      .discard = parent_ctx->discard,
+      .skip = parent_ctx->skip,
+      .skip_n = parent_ctx->skip_n
+    };
+    ctx.group_stack.push_back(&task.parent);
+
+    const char* curr_ptr = base_ptr + task.begin;
+    while (curr_ptr < base_ptr + task.end) {
+      char chunk_id[5] = { 0, 0, 0, 0, 0 };
+      uint32_t expected_next_chunk_offset, dunno;
+      curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+      auto id_chunk_id = id(chunk_id);
+      switch (id_chunk_id) {
+      case id("CNTB"):
+        curr_ptr = parse_cntb(&ctx, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
+        break;
+      case id("PRIM"): [[fallthrough]];
+      case id("OBST"): [[fallthrough]];
+      case id("INSU"):
+        curr_ptr = parse_prim(&ctx, base_ptr, curr_ptr, end_ptr, id_chunk_id, expected_next_chunk_offset);
+        break;
+      default:
+        assert(false && "Chunk kind not included in scan");
+        curr_ptr = nullptr;
+        break;
+      }
+      if (curr_ptr == nullptr) return false;
+    }
+    return true;
+  }
+
+  // Parse the chunks following MODL using a thread pool. Groups down to a split depth are
+  // parsed on the calling thread, while runs of chunks below are parsed by the workers
+  // and grafted into the tree in file order, giving the same result as a serial parse.
+  bool parse_model_parallel(Context* ctx, const std::vector<ScanEntry>& entries, const size_t* groupsAtDepth,
+                            unsigned threads, const char* base_ptr, const char* end_ptr)
+  {
+    // Split at the shallowest depth with enough groups to keep the workers busy.
+    uint32_t splitDepth = 0;
+    for (uint32_t d = 0; d <= maxScanDepth; d++) {
+      if (groupsAtDepth[splitDepth] < groupsAtDepth[d]) splitDepth = d;
+      if (4 * threads <= groupsAtDepth[d]) {
+        splitDepth = d;
+        break;
+      }
+    }
+
+    // Adjacent siblings are batched into tasks of roughly this size.
+    const size_t taskSize = std::max(size_t(1), size_t(end_ptr - base_ptr) / (16 * threads));
+
+    struct Step
+    {
+      const ScanEntry* entry;
+      size_t task;
+    };
+    constexpr size_t noTask = ~size_t(0);
+    std::vector<Step> steps;
+    std::vector<ParseTask> tasks;
+    size_t discardedEnd = 0;
+    for (const auto& entry : entries) {
+      if (splitDepth < entry.depth || entry.begin < discardedEnd) continue;
+      if (entry.kind == ScanEntry::Kind::Group && is_discarded(ctx->discard, base_ptr + entry.begin + 6 * 4, end_ptr)) {
+        ctx->discard->discarded++;
+        discardedEnd = entry.end;
+        continue;
+      }
+      if (entry.kind == ScanEntry::Kind::Geometries || (entry.kind == ScanEntry::Kind::Group && entry.depth == splitDepth)) {
+        if (!steps.empty() && steps.back().task != noTask) {
+          auto& prev = tasks[steps.back().task];
+          if (prev.end == entry.begin && steps.back().entry->depth == entry.depth && prev.end - prev.begin < taskSize) {
+            prev.end = entry.end;
+            continue;
+          }
+        }
+        steps.push_back(Step{ &entry, tasks.size() });
+        auto& task = tasks.emplace_back();
+        task.begin = entry.begin;
+        task.end = entry.end;
+        std::memset(static_cast<void*>(&task.parent), 0, sizeof(Node));
+        task.parent.kind = entry.depth == 0 ? Node::Kind::Model : Node::Kind::Group;
+        task.parent.group.transparency = entry.transparency;
+      }
+      else {
+        steps.push_back(Step{ &entry, noTask });
+      }
+    }
+
+    std::mutex mutex;
+    std::condition_variable taskDone;
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> abort = false;
+    auto worker = [&]() {
+      for (size_t i = next++; i < tasks.size() && !abort; i = next++) {
+        auto& task = tasks[i];
+        auto* store = new Store();
+        task.store = store;
+        bool success = parse_task(task, ctx, base_ptr, end_ptr);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          task.success = success;
+          task.done = true;
+        }
+        taskDone.notify_all();
+      }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(size_t(threads), tasks.size()); i++) {
+      workers.emplace_back(worker);
+    }
+
+    bool rv = true;
+    std::vector<size_t> groupEnds;
+    for (const auto& step : steps) {
+      while (!groupEnds.empty() && groupEnds.back() <= step.entry->begin) {
+        groupEnds.pop_back();
+        ctx->group_stack.pop_back();
+      }
+
+      const char* curr_ptr = base_ptr + step.entry->begin;
+      char chunk_id[5] = { 0, 0, 0, 0, 0 };
+      uint32_t expected_next_chunk_offset, dunno;
+
+      if (step.task != noTask) {
+        auto& task = tasks[step.task];
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          taskDone.wait(lock, [&task] { return task.done; });
+        }
+        if (!task.success) {
+          ctx->store->setErrorString(task.store->errorString());
+          rv = false;
+          break;
+        }
+        ctx->store->append(ctx->group_stack.back(), &task.parent, task.store);
+        delete task.store;
+        task.store = nullptr;
+        continue;
+      }
+
+      switch (step.entry->kind) {
+      case ScanEntry::Kind::Group:
+        curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+        curr_ptr = parse_cntb_header(ctx, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
+        groupEnds.push_back(step.entry->end);
+        break;
+      case ScanEntry::Kind::Color:
+        curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+        curr_ptr = parse_colr(ctx, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
+        break;
+      case ScanEntry::Kind::StrayEnd:
+        ctx->logger(1, "Encountered unexpected CNTE chunk at root level, ignoring.");
+        break;
+      default:
+        assert(false && "Unexpected scan entry");
+        break;
+      }
+      if (curr_ptr == nullptr) {
+        rv = false;
+        break;
+      }
+    }
+    ctx->group_stack.resize(2);
+
+    abort = true;
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    for (auto& task : tasks) {
+      delete task.store;
+    }
+    return rv;
+  }
+
 }
 
-bool parseRVM(class Store* store, Logger logger, const char* path, const void * ptr, size_t size)
+Polygon* facetGroupPolygons(Arena* arena, const Geometry* geo)
+{
+  assert(geo->kind == Geometry::Kind::FacetGroup);
+  if (geo->facetGroup.polygons != nullptr || geo->facetGroup.encoded == nullptr) {
+    return geo->facetGroup.polygons;
+  }
+
+  // Extent of data was verified when parsed.
+  Polygon* polygons = nullptr;
+  read_facet_group(arena, polygons, geo->facetGroup.polygons_n, geo->facetGroup.encoded, nullptr);
+  return polygons;
+}
+
+bool parseRVM(class Store* store, Logger logger, const char* path, const void * ptr, size_t size, unsigned threads, bool lazyFacetGroups, DiscardList* discard,
+              const SkipRange* skip, size_t skip_n)
 {
   char buf[1024];
   Context ctx = {
-    .store = store, 
+    .store = store,
+    .strings = &store->strings,
     .logger = logger,
     .buf = buf,
-    .buf_size = sizeof(buf)
+    .buf_size = sizeof(buf),
+    .lazyFacetGroups = lazyFacetGroups,
+    .discard = discard,
+    .skip = skip,
+    .skip_n = skip_n
   };
 
   const char* base_ptr = reinterpret_cast<const char*>(ptr);
@@ -467,6 +1017,21 @@ bool parseRVM(class Store* store, Logger logger, const char* path, const void *
   curr_ptr = parse_modl(&ctx, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
   if (curr_ptr == nullptr) return false;
 
+  if (1 < threads) {
+    auto time0 = std::chrono::high_resolution_clock::now();
+    std::vector<ScanEntry> entries;
+    size_t groupsAtDepth[maxScanDepth + 1] = {};
+    if (scan_chunks(entries, groupsAtDepth, skip, skip_n, base_ptr, curr_ptr, end_ptr)) {
+      long long e = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
+      logger(0, "Scanned %s into %zu chunk ranges (%lldms)", path, entries.size(), e);
+
+      bool rv = parse_model_parallel(&ctx, entries, groupsAtDepth, threads, base_ptr, end_ptr);
+      store->updateCounts();
+      return rv;
+    }
+    logger(1, "Failed to scan chunk structure of %s, parsing single-threaded.", path);
+  }
+
   curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
   auto id_chunk_id = id(chunk_id);
   while (curr_ptr < end_ptr && id_chunk_id != id("END:")) {
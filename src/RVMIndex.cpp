@@ -0,0 +1,355 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#include "RVMIndex.h"
+#include "LinAlgOps.h"
+
+namespace {
+
+  const char indexMagic[8] = { 'R', 'V', 'M', 'I', 'D', 'X', 0, 0 };
+  const uint32_t indexVersion = 2;
+  const uint32_t none = ~0u;
+
+  // Written in host byte order, an index from a host of different endianness fails the
+  // version check and is rebuilt.
+  struct IndexHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t entries_n;
+    RVMIndexFingerprint rvm;
+    RVMIndexFingerprint att;
+  };
+
+  constexpr uint32_t id(const char* str)
+  {
+    return str[0] << 24 | str[1] << 16 | str[2] << 8 | str[3];
+  }
+
+  uint32_t read_uint32_be(const char* ptr)
+  {
+    auto * q = reinterpret_cast<const uint8_t*>(ptr);
+    return uint32_t(q[0]) << 24 | uint32_t(q[1]) << 16 | uint32_t(q[2]) << 8 | uint32_t(q[3]);
+  }
+
+  float read_float32_be(const char* ptr)
+  {
+    uint32_t t = read_uint32_be(ptr);
+    float f;
+    std::memcpy(&f, &t, sizeof(f));
+    return f;
+  }
+
+  bool indexChunks(RVMIndex& index, Logger logger, const char* base_ptr, size_t size)
+  {
+    const char* end_ptr = base_ptr + size;
+    const char* curr_ptr = base_ptr;
+    std::vector<uint32_t> stack;
+    while (true) {
+      const size_t chunk_offset = curr_ptr - base_ptr;
+      if (end_ptr < curr_ptr + 6 * 4) {
+        logger(2, "RVMIndex: Unexpected end of file at offset %#zx", chunk_offset);
+        return false;
+      }
+
+      uint32_t chunk_id = 0;
+      for (unsigned i = 0; i < 4; i++) {
+        if (curr_ptr[4 * i] != 0 || curr_ptr[4 * i + 1] != 0 || curr_ptr[4 * i + 2] != 0) {
+          logger(2, "RVMIndex: Invalid chunk id at offset %#zx", chunk_offset);
+          return false;
+        }
+        chunk_id = (chunk_id << 8) | uint8_t(curr_ptr[4 * i + 3]);
+      }
+      const uint32_t next_chunk_offset = read_uint32_be(curr_ptr + 4 * 4);
+      curr_ptr += 6 * 4;
+
+      // Offsets are stored as 32 bits and wrap around in files larger than 4GB.
+      const char* next_ptr = curr_ptr + static_cast<uint32_t>(next_chunk_offset - static_cast<uint32_t>(curr_ptr - base_ptr));
+
+      switch (chunk_id) {
+      case id("HEAD"): [[fallthrough]];
+      case id("MODL"): [[fallthrough]];
+      case id("COLR"):
+        if (end_ptr < next_ptr) {
+          logger(2, "RVMIndex: Chunk at offset %#zx extends past end of file", chunk_offset);
+          return false;
+        }
+        curr_ptr = next_ptr;
+        break;
+
+      case id("CNTB"): {
+        if (next_ptr < curr_ptr + 2 * 4 || end_ptr < next_ptr) {
+          logger(2, "RVMIndex: Invalid CNTB chunk at offset %#zx", chunk_offset);
+          return false;
+        }
+        const char* name = curr_ptr + 2 * 4;
+        size_t l = std::min(size_t(4) * read_uint32_be(curr_ptr + 4), size_t(next_ptr - name));
+        for (size_t i = 0; i < l; i++) {
+          if (name[i] == 0) {
+            l = i;
+            break;
+          }
+        }
+
+        RVMIndexEntry entry{};
+        entry.nameHash = fnv_1a(name, l);
+        entry.begin = chunk_offset;
+        entry.parent = stack.empty() ? none : stack.back();
+        entry.depth = static_cast<uint32_t>(stack.size());
+        entry.bboxWorld = createEmptyBBox3f();
+        stack.push_back(static_cast<uint32_t>(index.entries.size()));
+        index.entries.push_back(entry);
+        curr_ptr = next_ptr;
+        break;
+      }
+
+      case id("PRIM"): [[fallthrough]];
+      case id("OBST"): [[fallthrough]];
+      case id("INSU"): {
+        if (stack.empty() || next_ptr < curr_ptr + (2 + 12 + 6) * 4 || end_ptr < next_ptr) {
+          logger(2, "RVMIndex: Invalid geometry chunk at offset %#zx", chunk_offset);
+          return false;
+        }
+        Mat3x4f M;
+        BBox3f bboxLocal;
+        for (unsigned i = 0; i < 12; i++) M.data[i] = read_float32_be(curr_ptr + 4 * (2 + i));
+        for (unsigned i = 0; i < 6; i++) bboxLocal.data[i] = read_float32_be(curr_ptr + 4 * (2 + 12 + i));
+
+        auto & entry = index.entries[stack.back()];
+        engulf(entry.bboxWorld, transform(M, bboxLocal));
+        entry.geometries++;
+        curr_ptr = next_ptr;
+        break;
+      }
+
+      case id("CNTE"): {
+        if (stack.empty() || end_ptr < curr_ptr + 4) {
+          logger(2, "RVMIndex: Invalid CNTE chunk at offset %#zx", chunk_offset);
+          return false;
+        }
+        curr_ptr += 4;
+
+        auto & entry = index.entries[stack.back()];
+        entry.end = curr_ptr - base_ptr;
+        stack.pop_back();
+        if (!stack.empty()) {
+          auto & parent = index.entries[stack.back()];
+          engulf(parent.bboxWorld, entry.bboxWorld);
+          parent.geometries += entry.geometries;
+        }
+        break;
+      }
+
+      case id("END:"):
+        if (!stack.empty()) {
+          logger(2, "RVMIndex: Unexpected END: chunk at offset %#zx", chunk_offset);
+          return false;
+        }
+        return true;
+
+      default:
+        logger(2, "RVMIndex: Unknown chunk id at offset %#zx", chunk_offset);
+        return false;
+      }
+    }
+  }
+
+
+  const char* getEndOfLine(const char* p, const char* end)
+  {
+    while (p < end && (*p != '\n' && *p != '\r'))  p++;
+    return p;
+  }
+
+  const char* skipEndOfLine(const char* p, const char* end)
+  {
+    while (p < end && (*p == '\n' || *p == '\r'))  p++;
+    return p;
+  }
+
+  const char* skipSpace(const char* p, const char* end)
+  {
+    while (p < end && (*p == ' ' || *p == '\t'))  p++;
+    return p;
+  }
+
+  const char* reverseSkipSpace(const char* start, const char* p)
+  {
+    while (start < p && (p[-1] == ' ' || p[-1] == '\t')) p--;
+    return p;
+  }
+
+  uint64_t attKey(uint32_t parent, uint64_t nameHash)
+  {
+    uint64_t key = nameHash ^ ((uint64_t(parent) + 1) * 0x9E3779B97F4A7C15ull);
+    return key ? key : 1;
+  }
+
+  // Match NEW...END blocks to groups the same way parseAtt does, by name among the root
+  // groups or the children of the parent block's group. Lines are counted like parseAtt.
+  void indexAttBlocks(RVMIndex& index, const char* base, size_t size)
+  {
+    Map lookup;
+    for (size_t i = 0; i < index.entries.size(); i++) {
+      const auto& entry = index.entries[i];
+      uint64_t key = attKey(entry.parent, entry.nameHash);
+      if (lookup.get(key) == 0) {
+        lookup.insert(key, i + 1);
+      }
+    }
+
+    struct OpenBlock
+    {
+      uint32_t entry;
+      uint64_t begin;
+      uint32_t line;
+    };
+    std::vector<OpenBlock> stack;
+
+    const char* end = base + size;
+    const char* p = skipEndOfLine(getEndOfLine(base, end), end);
+    for (uint32_t line = 1; p < end; line++) {
+      const char* line_ptr = p;
+      p = skipSpace(p, end);
+      if ((p + 3 < end) && p[0] == 'N' && p[1] == 'E' && p[2] == 'W' && (p[3] == ' ' || p[3] == '\t')) {
+        const char* a = skipSpace(p + 4, end);
+        p = getEndOfLine(a, end);
+        const char* b = reverseSkipSpace(a, p);
+
+        uint32_t entry = none;
+        if (stack.empty() || stack.back().entry != none) {
+          uint64_t val = lookup.get(attKey(stack.empty() ? none : stack.back().entry, fnv_1a(a, b - a)));
+          if (val) entry = static_cast<uint32_t>(val - 1);
+        }
+        stack.push_back(OpenBlock{ entry, uint64_t(line_ptr - base), line });
+      }
+      else if ((p + 2 < end) && p[0] == 'E' && p[1] == 'N' && p[2] == 'D') {
+        if (stack.empty()) return;
+        p = skipEndOfLine(getEndOfLine(p, end), end);
+
+        const auto block = stack.back();
+        stack.pop_back();
+        if (block.entry != none && index.entries[block.entry].attLines == 0) {
+          auto & entry = index.entries[block.entry];
+          entry.attBegin = block.begin;
+          entry.attEnd = p - base;
+          entry.attLine = block.line;
+          entry.attLines = line - block.line + 1;
+        }
+        continue;
+      }
+      else {
+        p = getEndOfLine(p, end);
+      }
+      p = skipEndOfLine(p, end);
+    }
+  }
+
+}
+
+
+uint64_t rvmIndexHash(const void* ptr, size_t size)
+{
+  const size_t window = 4096;
+  auto * bytes = reinterpret_cast<const char*>(ptr);
+  if (size <= 2 * window) return fnv_1a(bytes, size);
+
+  return (fnv_1a(bytes, window) * 0x100000001B3ull) ^ fnv_1a(bytes + size - window, window);
+}
+
+
+bool buildRVMIndex(RVMIndex& index, Logger logger, const void* rvmPtr, size_t rvmSize, const void* attPtr, size_t attSize)
+{
+  index.rvm = RVMIndexFingerprint{ rvmSize, 0, rvmIndexHash(rvmPtr, rvmSize) };
+  index.att = attPtr ? RVMIndexFingerprint{ attSize, 0, rvmIndexHash(attPtr, attSize) } : RVMIndexFingerprint{};
+  index.entries.clear();
+  if (!indexChunks(index, logger, reinterpret_cast<const char*>(rvmPtr), rvmSize)) return false;
+
+  if (attPtr) {
+    indexAttBlocks(index, reinterpret_cast<const char*>(attPtr), attSize);
+  }
+  return true;
+}
+
+
+bool writeRVMIndex(const RVMIndex& index, Logger logger, const char* path)
+{
+  FILE* out = nullptr;
+#ifdef _WIN32
+  if (fopen_s(&out, path, "wb") != 0) out = nullptr;
+#else
+  out = fopen(path, "wb");
+#endif
+  if (out == nullptr) {
+    logger(2, "RVMIndex: Failed to open %s for writing.", path);
+    return false;
+  }
+
+  IndexHeader header{};
+  std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+  header.version = indexVersion;
+  header.entries_n = static_cast<uint32_t>(index.entries.size());
+  header.rvm = index.rvm;
+  header.att = index.att;
+
+  bool rv = fwrite(&header, sizeof(header), 1, out) == 1;
+  if (rv && !index.entries.empty()) {
+    rv = fwrite(index.entries.data(), sizeof(RVMIndexEntry), index.entries.size(), out) == index.entries.size();
+  }
+  if (fclose(out) != 0) rv = false;
+  if (!rv) {
+    logger(2, "RVMIndex: Failed to write %s.", path);
+  }
+  return rv;
+}
+
+
+bool readRVMIndex(RVMIndex& index, Logger logger, const char* path)
+{
+  FILE* in = nullptr;
+#ifdef _WIN32
+  if (fopen_s(&in, path, "rb") != 0) in = nullptr;
+#else
+  in = fopen(path, "rb");
+#endif
+  if (in == nullptr) return false;
+
+  bool rv = false;
+  IndexHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 || std::memcmp(header.magic, indexMagic, sizeof(indexMagic)) != 0) {
+    logger(1, "RVMIndex: %s is not an rvm index.", path);
+  }
+  else if (header.version != indexVersion) {
+    logger(1, "RVMIndex: %s has unsupported version %u.", path, header.version);
+  }
+  else {
+    index.rvm = header.rvm;
+    index.att = header.att;
+    index.entries.resize(header.entries_n);
+    rv = index.entries.empty() || fread(index.entries.data(), sizeof(RVMIndexEntry), index.entries.size(), in) == index.entries.size();
+    if (!rv) {
+      logger(1, "RVMIndex: %s is truncated.", path);
+    }
+  }
+  fclose(in);
+  return rv;
+}
+
+
+void rvmIndexSkipRanges(std::vector<SkipRange>& rvmSkip, std::vector<SkipRange>& attSkip, const RVMIndex& index, const BBox3f& bbox)
+{
+  uint64_t skippedEnd = 0;
+  for (const auto& entry : index.entries) {
+    if (entry.begin < skippedEnd) continue;   // Inside a skipped group.
+    if (isEmpty(entry.bboxWorld) || isOverlapping(entry.bboxWorld, bbox)) continue;
+
+    rvmSkip.push_back(SkipRange{ entry.begin, entry.end, 0 });
+    if (entry.attLines) {
+      attSkip.push_back(SkipRange{ entry.attBegin, entry.attEnd, entry.attLines });
+    }
+    skippedEnd = entry.end;
+  }
+  std::sort(attSkip.begin(), attSkip.end(), [](const SkipRange& a, const SkipRange& b) { return a.begin < b.begin; });
+}
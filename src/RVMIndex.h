@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include "Common.h"
+#include "LinAlg.h"
+#include "Parser.h"
+
+// A group of an rvm file, found in the index written next to it with the suffix .rvmidx.
+struct RVMIndexEntry
+{
+  uint64_t nameHash;    // fnv_1a of the group name.
+  uint64_t begin;       // Byte range of the CNTB chunk, including children and CNTE.
+  uint64_t end;
+  uint64_t attBegin;    // Byte range of the NEW...END block in the att file, empty if none.
+  uint64_t attEnd;
+  uint32_t attLine;     // First line and number of lines of the att block.
+  uint32_t attLines;
+  uint32_t parent;      // Index of the parent entry, ~0u for root groups.
+  uint32_t depth;
+  uint32_t geometries;  // Number of geometries in the subtree.
+  uint32_t padding;
+  BBox3f bboxWorld;     // World bounding box of the geometries in the subtree.
+};
+
+// Identifies the contents of an indexed file, an index is only used if these match.
+struct RVMIndexFingerprint
+{
+  uint64_t size = 0;
+  int64_t modified = 0;   // Last write time, in ticks of the file clock.
+  uint64_t hash = 0;      // See rvmIndexHash.
+
+  bool operator==(const RVMIndexFingerprint&) const = default;
+};
+
+struct RVMIndex
+{
+  RVMIndexFingerprint rvm;
+  RVMIndexFingerprint att;  // All zero if no att file was indexed.
+  std::vector<RVMIndexEntry> entries;   // In file order, so parents come before children.
+};
+
+// Hash of the first and last 4kB of a file, which hold the date in the HEAD chunk of an rvm
+// file and the end of its chunk structure. Catches edits that keep the size and write time.
+uint64_t rvmIndexHash(const void* ptr, size_t size);
+
+// Build index by following the chunk offsets of an rvm file, reading only chunk headers,
+// group names and primitive bounding boxes. The att file is optional. Sets the sizes and
+// hashes of the fingerprints, the write times are left to the caller.
+bool buildRVMIndex(RVMIndex& index, Logger logger, const void* rvmPtr, size_t rvmSize, const void* attPtr, size_t attSize);
+
+bool writeRVMIndex(const RVMIndex& index, Logger logger, const char* path);
+
+bool readRVMIndex(RVMIndex& index, Logger logger, const char* path);
+
+// Ranges of the topmost groups whose geometries all lie outside bbox, sorted by offset.
+void rvmIndexSkipRanges(std::vector<SkipRange>& rvmSkip, std::vector<SkipRange>& attSkip, const RVMIndex& index, const BBox3f& bbox);
@@ -2,7 +2,9 @@
 #include <cassert>
 #include <cstring>
 #include "Store.h"
+#include "Parser.h"
 #include "StoreVisitor.h"
+#include "LinAlgOps.h"
 
 
 
@@ -20,6 +22,96 @@ namespace {
     }
   }
 
+  template<typename T>
+  void splice(ListHeader<T>& list, ListHeader<T>& src)
+  {
+    if (src.first == nullptr) return;
+    if (list.first == nullptr) {
+      list.first = src.first;
+    }
+    else {
+      list.last->next = src.first;
+    }
+    list.last = src.last;
+    src.clear();
+  }
+
+  // Copy of src in arena, or the copy made earlier if src is in clones.
+  void* dupShared(Arena& arena, Map* clones, const void* src, size_t bytes)
+  {
+    if (src == nullptr) return nullptr;
+    if (clones) {
+      if (auto dst = clones->get(uint64_t(src))) return (void*)dst;
+    }
+    auto * dst = arena.dup(src, bytes);
+    if (clones) clones->insert(uint64_t(src), uint64_t(dst));
+    return dst;
+  }
+
+  const char* reintern(StringInterning& strings, const char* str)
+  {
+    return str ? strings.intern(str) : nullptr;
+  }
+
+  void reinternRecurse(StringInterning& strings, Node* node, unsigned geometryIdOffset)
+  {
+    switch (node->kind) {
+    case Node::Kind::File:
+      node->file.info = reintern(strings, node->file.info);
+      node->file.note = reintern(strings, node->file.note);
+      node->file.date = reintern(strings, node->file.date);
+      node->file.user = reintern(strings, node->file.user);
+      node->file.encoding = reintern(strings, node->file.encoding);
+      node->file.path = reintern(strings, node->file.path);
+      break;
+    case Node::Kind::Model:
+      node->model.project = reintern(strings, node->model.project);
+      node->model.name = reintern(strings, node->model.name);
+      break;
+    case Node::Kind::Group:
+      node->group.name = reintern(strings, node->group.name);
+      for (auto * geo = node->group.geometries.first; geo != nullptr; geo = geo->next) {
+        geo->id += geometryIdOffset;
+        geo->colorName = reintern(strings, geo->colorName);
+      }
+      break;
+    default:
+      assert(false && "Group has invalid kind.");
+      break;
+    }
+
+    for (auto * att = node->attributes.first; att != nullptr; att = att->next) {
+      att->key = reintern(strings, att->key);
+      att->val = reintern(strings, att->val);
+    }
+
+    for (auto * child = node->children.first; child != nullptr; child = child->next) {
+      reinternRecurse(strings, child, geometryIdOffset);
+    }
+  }
+
+  void offsetGeometryIdsRecurse(Node* node, unsigned geometryIdOffset)
+  {
+    if (node->kind == Node::Kind::Group) {
+      for (auto * geo = node->group.geometries.first; geo != nullptr; geo = geo->next) {
+        geo->id += geometryIdOffset;
+      }
+    }
+    for (auto * child = node->children.first; child != nullptr; child = child->next) {
+      offsetGeometryIdsRecurse(child, geometryIdOffset);
+    }
+  }
+
+
+}
+
+
+Mat3x4f triangulationMatrix(const Geometry* geo)
+{
+  if (geo->triangulation && geo->triangulation->instance) {
+    return mul(geo->M_3x4, *geo->triangulation->instance);
+  }
+  return geo->M_3x4;
 }
 
 
@@ -28,9 +120,22 @@ Store::Store()
   roots.clear();
   debugLines.clear();
   connections.clear();
+  mappedFiles.clear();
   setErrorString("");
 }
 
+Store::~Store()
+{
+  while (auto * file = mappedFiles.popFront()) {
+    delete file;
+  }
+}
+
+void Store::keepMapped(MappedFile* file)
+{
+  insert(mappedFiles, file);
+}
+
 Color* Store::newColor(Node* parent)
 {
   assert(parent != nullptr);
@@ -96,7 +201,7 @@ Geometry* Store::newGeometry(Node* parent)
   return geo;
 }
 
-Geometry* Store::cloneGeometry(Node* parent, const Geometry* src)
+Geometry* Store::cloneGeometry(Node* parent, const Geometry* src, Map* clones)
 {
   auto * dst = newGeometry(parent);
   dst->kind = src->kind;
@@ -105,6 +210,7 @@ Geometry* Store::cloneGeometry(Node* parent, const Geometry* src)
   dst->bboxWorld = src->bboxWorld;
   dst->id = src->id;
   dst->sampleStartAngle = src->sampleStartAngle;
+  dst->culled = src->culled;
   switch (dst->kind) {
     case Geometry::Kind::Pyramid:
     case Geometry::Kind::Box:
@@ -120,6 +226,12 @@ Geometry* Store::cloneGeometry(Node* parent, const Geometry* src)
       break;
     case Geometry::Kind::FacetGroup:
       dst->facetGroup.polygons_n = src->facetGroup.polygons_n;
+      dst->facetGroup.encoded = nullptr;
+      if (src->facetGroup.polygons == nullptr) {
+        // Deferred decoding references data owned by the source store, decode into ours.
+        dst->facetGroup.polygons = facetGroupPolygons(&arena, src);
+        break;
+      }
       dst->facetGroup.polygons = (Polygon*)arena.alloc(sizeof(Polygon)*dst->facetGroup.polygons_n);
       for (unsigned k = 0; k < dst->facetGroup.polygons_n; k++) {
         auto & dst_poly = dst->facetGroup.polygons[k];
@@ -145,23 +257,29 @@ Geometry* Store::cloneGeometry(Node* parent, const Geometry* src)
   }
   dst->color = src->color;
 
-  if (src->triangulation) {
+  uint64_t val;
+  if (src->triangulation && clones && clones->get(val, uint64_t(src->triangulation))) {
+    dst->triangulation = (Triangulation*)val;
+  }
+  else if (src->triangulation) {
     dst->triangulation = arena.alloc<Triangulation>();
 
     const auto * stri = src->triangulation;
     auto * dtri = dst->triangulation;
     dtri->error = stri->error;
     dtri->id = stri->id;
+    dtri->instance = (const Mat3x4f*)dupShared(arena, clones, stri->instance, sizeof(Mat3x4f));
     if (stri->vertices_n) {
       dtri->vertices_n = stri->vertices_n;
-      dtri->vertices = (float*)arena.dup(stri->vertices, 3 * sizeof(float) * dtri->vertices_n);
-      dtri->normals = (float*)arena.dup(stri->normals, 3 * sizeof(float) * dtri->vertices_n);
-      dtri->texCoords = (float*)arena.dup(stri->texCoords, 2 * sizeof(float) * dtri->vertices_n);
+      dtri->vertices = (float*)dupShared(arena, clones, stri->vertices, 3 * sizeof(float) * dtri->vertices_n);
+      dtri->normals = (float*)dupShared(arena, clones, stri->normals, 3 * sizeof(float) * dtri->vertices_n);
+      dtri->texCoords = (float*)dupShared(arena, clones, stri->texCoords, 2 * sizeof(float) * dtri->vertices_n);
     }
     if (stri->triangles_n) {
       dtri->triangles_n = stri->triangles_n;
-      dtri->indices = (uint32_t*)arena.dup(stri->indices, 3 * sizeof(uint32_t) * dtri->triangles_n);
+      dtri->indices = (uint32_t*)dupShared(arena, clones, stri->indices, 3 * sizeof(uint32_t) * dtri->triangles_n);
     }
+    if (clones) clones->insert(uint64_t(stri), uint64_t(dtri));
   }
 
   return dst;
@@ -185,6 +303,51 @@ Node* Store::newNode(Node* parent, Node::Kind kind)
   return grp;
 }
 
+void Store::adopt(Store* src)
+{
+  assert(src != this);
+  arena.adopt(src->arena);
+  arenaTriangulation.adopt(src->arenaTriangulation);
+
+  splice(debugLines, src->debugLines);
+  splice(connections, src->connections);
+  splice(mappedFiles, src->mappedFiles);
+
+  numGroupsAllocated += src->numGroupsAllocated;
+  numGeometriesAllocated += src->numGeometriesAllocated;
+  src->numGroupsAllocated = 0;
+  src->numGeometriesAllocated = 0;
+}
+
+void Store::append(Store* src)
+{
+  for (auto * root = src->roots.first; root != nullptr; root = root->next) {
+    reinternRecurse(strings, root, numGeometriesAllocated);
+  }
+  splice(roots, src->roots);
+  adopt(src);
+
+  updateCounts();
+  src->updateCounts();
+}
+
+void Store::append(Node* parent, Node* srcParent, Store* src)
+{
+  for (auto * child = srcParent->children.first; child != nullptr; child = child->next) {
+    offsetGeometryIdsRecurse(child, numGeometriesAllocated);
+  }
+  splice(parent->children, srcParent->children);
+
+  if (srcParent->kind == Node::Kind::Group) {
+    assert(parent->kind == Node::Kind::Group || srcParent->group.geometries.first == nullptr);
+    for (auto * geo = srcParent->group.geometries.first; geo != nullptr; geo = geo->next) {
+      geo->id += numGeometriesAllocated;
+    }
+    splice(parent->group.geometries, srcParent->group.geometries);
+  }
+  adopt(src);
+}
+
 Attribute* Store::getAttribute(Node* group, const char* key)
 {
   for (auto * attribute = group->attributes.first; attribute != nullptr; attribute = attribute->next) {
@@ -28,6 +28,7 @@ struct Triangulation {
   uint32_t triangles_n = 0;
   int32_t id = 0;
   float error = 0.f;
+  const Mat3x4f* instance = nullptr;  // If set, the arrays are shared by a unit primitive placed by this matrix, see triangulationMatrix.
 };
 
 struct Color
@@ -55,7 +56,7 @@ struct Connection
   Flags flags = Flags::None;
 
   void setFlag(Flags flag) { flags = (Flags)((uint8_t)flags | (uint8_t)flag); }
-  bool hasFlag(Flags flag) { return (uint8_t)flags & (uint8_t)flag; }
+  bool hasFlag(Flags flag) const { return (uint8_t)flags & (uint8_t)flag; }
 
 };
 
@@ -94,6 +95,7 @@ struct Geometry
   Kind kind;
   Type type = Geometry::Type::Primitive;
   uint32_t transparency = 0;                 ///< Transparency of primitive, a percentage in [0,100].
+  bool culled = false;                       // Too small to tessellate, left out of the exports.
 
   unsigned id;
 
@@ -149,12 +151,16 @@ struct Geometry
       float a, b;
     } line;
     struct {
-      struct Polygon* polygons;
+      struct Polygon* polygons;   // Null if decoding is deferred, see facetGroupPolygons.
       uint32_t polygons_n;
+      const char* encoded;        // Big-endian polygon data in the mapped rvm file if deferred.
     } facetGroup;
   };
 };
 
+// Transform from the triangulation vertices of geo to world, includes the instance matrix if any.
+Mat3x4f triangulationMatrix(const Geometry* geo);
+
 template<typename T>
 struct ListHeader
 {
@@ -262,6 +268,15 @@ struct DebugLine
   uint32_t color = 0xff0000u;
 };
 
+// How far connect and align have got, so that later passes only handle files appended since.
+// Anchors are only matched below the same top-level group, so geometries of new files never
+// connect to those of earlier files.
+struct Connectivity
+{
+  Node* lastRoot = nullptr;           // Last file connected.
+  Connection* lastAligned = nullptr;  // Last connection aligned.
+};
+
 
 class StoreVisitor;
 
@@ -269,12 +284,18 @@ class Store
 {
 public:
   Store();
+  Store(const Store&) = delete;
+  Store& operator=(const Store&) = delete;
+  ~Store();
 
   Color* newColor(Node* parent);
 
   Geometry* newGeometry(Node* parent);
 
-  Geometry* cloneGeometry(Node* parent, const Geometry* src);
+  // If clones is given, it maps source triangulations and their arrays to their copies in
+  // this store, so that triangulations shared in the source, like cached ones, and arrays
+  // shared by unit primitives, stay shared here.
+  Geometry* cloneGeometry(Node* parent, const Geometry* src, Map* clones = nullptr);
 
   Node* getDefaultModel();
 
@@ -290,10 +311,27 @@ public:
 
   void addDebugLine(float* a, float* b, uint32_t color);
 
+  // Keep file mapped for the lifetime of the store, as geometries may reference it.
+  void keepMapped(MappedFile* file);
+
   Connection* newConnection();
 
   void apply(StoreVisitor* visitor);
 
+  // Move the content of src to the end of this store, leaving src empty. Strings are
+  // re-interned and geometry ids offset, so the result is identical to having parsed
+  // the input of src directly into this store.
+  void append(Store* src);
+
+  // Move the children and geometries of srcParent, a node allocated by src, to the end
+  // of parent. The rest of src is left empty. Strings of the moved nodes must already be
+  // interned by this store.
+  void append(Node* parent, Node* srcParent, Store* src);
+
+  // Take over the arenas, connections, debug lines and mapped files of src, while nodes
+  // are left in src. Used to gather what worker threads have allocated in stores of their own.
+  void adopt(Store* src);
+
   unsigned groupCount_() const { return numGroups; }
   unsigned groupCountAllocated() const { return numGroupsAllocated; }
   unsigned leafCount() const { return numLeaves; }
@@ -307,6 +345,7 @@ public:
 
   Node* getFirstRoot() { return roots.first; }
   Connection* getFirstConnection() { return connections.first; }
+  Connection* getLastConnection() { return connections.last; }
   DebugLine* getFirstDebugLine() { return debugLines.first; }
 
   Arena arena;
@@ -338,5 +377,6 @@ private:
   ListHeader<Node> roots;
   ListHeader<DebugLine> debugLines;
   ListHeader<Connection> connections;
+  ListHeader<MappedFile> mappedFiles;
   
 };
\ No newline at end of file
@@ -4,56 +4,374 @@
 #include <cstdio>
 #include <cassert>
 #include <cstring>
+#include <thread>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include "tesselator.h"
 
 #include "Store.h"
 #include "Tessellator.h"
 #include "LinAlgOps.h"
+#include "Parser.h"
 
 namespace {
 
   const float pi = float(M_PI);
   const float half_pi = float(0.5*M_PI);
+  const float twopi = float(2.0*M_PI);
+
+  Triangulation* triangulate(TriangulationFactory* factory, Arena* arena, const Geometry* geo)
+  {
+    auto scale = getScale(geo->M_3x4);
+
+    switch (geo->kind) {
+    case Geometry::Kind::Pyramid:
+      return factory->pyramid(arena, geo, scale);
+
+    case Geometry::Kind::Box:
+      return factory->box(arena, geo, scale);
+
+    case Geometry::Kind::RectangularTorus:
+      return factory->rectangularTorus(arena, geo, scale);
+
+    case Geometry::Kind::CircularTorus:
+      return factory->circularTorus(arena, geo, scale);
+
+    case Geometry::Kind::EllipticalDish:
+      return factory->sphereBasedShape(arena, geo, geo->ellipticalDish.baseRadius, half_pi, 0.f, geo->ellipticalDish.height / geo->ellipticalDish.baseRadius, scale);
+
+    case Geometry::Kind::SphericalDish: {
+      float r_circ = geo->sphericalDish.baseRadius;
+      auto h = geo->sphericalDish.height;
+      float r_sphere = (r_circ*r_circ + h * h) / (2.f*h);
+      float sinval = std::min(1.f, std::max(-1.f, r_circ / r_sphere));
+      float arc = asin(sinval);
+      if (r_circ < h) { arc = pi - arc; }
+      return factory->sphereBasedShape(arena, geo, r_sphere, arc, h - r_sphere, 1.f, scale);
+    }
+    case Geometry::Kind::Snout:
+      return factory->snout(arena, geo, scale);
+
+    case Geometry::Kind::Cylinder:
+      return factory->cylinder(arena, geo, scale);
+
+    case Geometry::Kind::Sphere:
+      return factory->sphereBasedShape(arena, geo, 0.5f*geo->sphere.diameter, pi, 0.f, 1.f, scale);
+
+    case Geometry::Kind::FacetGroup:
+      return factory->facetGroup(arena, geo, scale);
+
+    case Geometry::Kind::Line:  // Not tessellated.
+    default:
+      assert(false && "Unhandled primitive type");
+      return nullptr;
+    }
+  }
+
+  // Triangles of a sphere-based shape, following the ring layout of sphereBasedShape.
+  uint64_t sphereBasedTriangles(TriangulationFactory* factory, float radius, float arc, float scale_z, float scale)
+  {
+    if (!std::isfinite(scale_z)) {
+      scale_z = 0;
+    }
+    unsigned samples = factory->sagittaBasedSegmentCount(twopi, radius, scale);
+    bool is_sphere = pi - 1e-3 <= arc;
+    if (is_sphere) {
+      arc = pi;
+    }
+    unsigned rings = unsigned(std::max(3.f, scale_z * samples*arc*(1.f / twopi)));
+
+    // Each pair of neighbouring rings is stitched with about as many triangles as they have samples.
+    uint64_t triangles = 0;
+    unsigned prev = 1;
+    for (unsigned r = 1; r < rings; r++) {
+      unsigned curr = (is_sphere && r + 1 == rings) ? 1 : unsigned(std::max(3.f, std::sin((arc / (rings - 1)) * r) * samples));
+      triangles += prev + curr;
+      prev = curr;
+    }
+    return triangles;
+  }
+
+  // Triangles produced when tessellating geo, where caps holds the caps left out by matching connections.
+  uint64_t triangleCount(TriangulationFactory* factory, const Geometry* geo, float scale, unsigned caps)
+  {
+    uint64_t openCaps = 2 - std::popcount(caps & 3u);
+    switch (geo->kind) {
+    case Geometry::Kind::Pyramid:
+    case Geometry::Kind::Box:
+      return 2 * uint64_t(6 - std::popcount(caps));
+
+    case Geometry::Kind::RectangularTorus:
+      return 8 * uint64_t(factory->sagittaBasedSegmentCount(geo->rectangularTorus.angle, geo->rectangularTorus.outer_radius, scale)) + 2 * openCaps;
+
+    case Geometry::Kind::CircularTorus: {
+      auto & ct = geo->circularTorus;
+      uint64_t segments_l = factory->sagittaBasedSegmentCount(ct.angle, ct.offset + ct.radius, scale);
+      uint64_t segments_s = factory->sagittaBasedSegmentCount(twopi, ct.radius, scale);
+      return 2 * segments_l * segments_s + (segments_s - 2) * openCaps;
+    }
+    case Geometry::Kind::EllipticalDish:
+      return sphereBasedTriangles(factory, geo->ellipticalDish.baseRadius, half_pi, geo->ellipticalDish.height / geo->ellipticalDish.baseRadius, scale);
+
+    case Geometry::Kind::SphericalDish: {
+      float r_circ = geo->sphericalDish.baseRadius;
+      auto h = geo->sphericalDish.height;
+      float r_sphere = (r_circ*r_circ + h * h) / (2.f*h);
+      float arc = asin(std::min(1.f, std::max(-1.f, r_circ / r_sphere)));
+      if (r_circ < h) { arc = pi - arc; }
+      return sphereBasedTriangles(factory, r_sphere, arc, 1.f, scale);
+    }
+    case Geometry::Kind::Snout:
+    case Geometry::Kind::Cylinder: {
+      auto radius = geo->kind == Geometry::Kind::Snout ? std::max(geo->snout.radius_b, geo->snout.radius_t) : geo->cylinder.radius;
+      uint64_t samples = factory->sagittaBasedSegmentCount(twopi, radius, scale);
+      return 2 * samples + (samples - 2) * openCaps;
+    }
+    case Geometry::Kind::Sphere:
+      return sphereBasedTriangles(factory, 0.5f*geo->sphere.diameter, pi, 1.f, scale);
+
+    default:
+      return 0;
+    }
+  }
+
+  // Triangles produced when tessellating a facet group, which does not depend on the tolerance.
+  uint64_t facetGroupTriangleCount(Arena* scratch, const Geometry* geo)
+  {
+    // A polygon with n vertices and c contours gives n + 2c - 4 triangles.
+    uint64_t triangles = 0;
+    const Polygon* polygons = facetGroupPolygons(scratch, geo);
+    for (unsigned p = 0; p < geo->facetGroup.polygons_n; p++) {
+      uint64_t n = 0;
+      for (unsigned c = 0; c < polygons[p].contours_n; c++) {
+        n += polygons[p].contours[c].vertices_n + 2;
+      }
+      triangles += 4 <= n ? n - 4 : 0;
+    }
+    scratch->reset();
+    return triangles;
+  }
+
+  // Collects the geometries with their sizes for culling, facet groups with their fixed triangle count.
+  struct BudgetCollector : public StoreVisitor
+  {
+    struct Item
+    {
+      const Geometry* geo;
+      float scale;
+      float diagonal;
+      unsigned caps;
+      uint64_t fixedTriangles;
+    };
+    std::vector<Item> items;
+    float maxDiagonal = 0.f;
+    Arena scratch;
+
+    void geometry(Geometry* geo) override
+    {
+      if (geo->kind == Geometry::Kind::Line) return;
+      float d = diagonal(geo->bboxWorld);
+      if (!isEmpty(geo->bboxWorld)) {
+        maxDiagonal = std::max(maxDiagonal, d);
+      }
+      if (geo->kind == Geometry::Kind::FacetGroup) {
+        items.push_back(Item{ geo, 1.f, d, 0, facetGroupTriangleCount(&scratch, geo) });
+      }
+      else {
+        items.push_back(Item{ geo, getScale(geo->M_3x4), d, TriangulationFactory::matchingCaps(geo), 0 });
+      }
+    }
+  };
+
+  // Facet groups and tori are the most expensive to tessellate, and are scheduled first.
+  bool moreExpensive(const Geometry* a, const Geometry* b)
+  {
+    auto rank = [](const Geometry* geo) {
+      switch (geo->kind) {
+      case Geometry::Kind::FacetGroup: return 3;
+      case Geometry::Kind::CircularTorus: return 2;
+      case Geometry::Kind::Sphere:
+      case Geometry::Kind::EllipticalDish:
+      case Geometry::Kind::SphericalDish: return 1;
+      default: return 0;
+      }
+    };
+    auto ra = rank(a);
+    auto rb = rank(b);
+    if (ra != rb) return rb < ra;
+    if (ra == 3) return b->facetGroup.polygons_n < a->facetGroup.polygons_n;
+    return false;
+  }
 
 }
 
-Tessellator::Tessellator(Logger logger, float tolerance, float cullLeafThreshold, float cullGeometryThreshold, unsigned maxSamples) :
+Tessellator::Tessellator(Logger logger, float tolerance, float cullLeafThreshold, float cullGeometryThreshold, unsigned maxSamples, unsigned threads, bool instancing) :
   logger(logger),
   tolerance(tolerance),
   maxSamples(maxSamples),
   cullLeafThresholdScaled(tolerance * cullLeafThreshold),
-  cullGeometryThresholdScaled(tolerance * cullGeometryThreshold)
+  cullGeometryThresholdScaled(tolerance * cullGeometryThreshold),
+  threads(std::max(1u, threads)),
+  instancing(instancing)
 {
 }
 
 Tessellator::~Tessellator()
 {
   delete factory;
+  for (auto * threadFactory : threadFactories) {
+    delete threadFactory;
+  }
 }
 
-Triangulation* Tessellator::getTriangulation(Geometry* geo)
+// Geometries with equal keys get identical triangulations in their local frames.
+struct Tessellator::CacheKey
 {
-  auto a = offsetof(Geometry, kind);
-  auto n = sizeof(Geometry) - a;
-
-  auto hash = fnv_1a((const char*)geo + a, n);
+  Geometry::Kind kind;
+  unsigned caps;
+  float scale;
+  float sampleStartAngle;
+  uint8_t parameters[sizeof(Geometry::snout)];  // Largest member of the parameter union, except facet groups.
+};
+
+struct Tessellator::CacheItem
+{
+  CacheItem* next;
+  Geometry* src;              // First geometry with this key, which is tessellated.
+  Triangulation* tri;
+  unsigned discardedCaps;     // Caps discarded when tessellating src.
+  CacheKey key;
+};
+
+Tessellator::CacheItem* Tessellator::getCacheItem(Geometry* geo)
+{
+  CacheKey key;
+  std::memset(&key, 0, sizeof(key));
+  key.kind = geo->kind;
+  key.caps = TriangulationFactory::matchingCaps(geo);
+  key.scale = getScale(geo->M_3x4);
+  key.sampleStartAngle = geo->sampleStartAngle;
+  std::memcpy(key.parameters, &geo->snout, sizeof(key.parameters));
+
+  auto hash = fnv_1a((const char*)&key, sizeof(key));
   if (hash == 0) hash = 1;
 
+  cacheLookups++;
   auto * firstItem = (CacheItem*)cache.map.get(hash);
   for (auto * item = firstItem; item != nullptr; item = item->next) {
-    if (std::memcmp((const char*)geo + a, (const char*)item->src + a, n) == 0) {
-      return item->tri;
+    if (std::memcmp(&key, &item->key, sizeof(key)) == 0) {
+      cacheHits++;
+      return item;
     }
   }
 
-  // FIXME: create tri.
-
   auto * item = &cache.items[cache.fill++];
   item->next = firstItem;
   item->src = geo;
   item->tri = nullptr;
+  item->discardedCaps = 0;
+  item->key = key;
   cache.map.insert(hash, uint64_t(item));
-  return item->tri;
+  return item;
+}
+
+void Tessellator::tessellateSource(TriangulationFactory* factory, Arena* arena, Geometry* geo, CacheItem* item)
+{
+  auto discardedCaps = factory->discardedCaps;
+  geo->triangulation = triangulate(factory, arena, geo);
+  geo->triangulation->id = geo->id;
+  if (item) {
+    item->tri = geo->triangulation;
+    item->discardedCaps = factory->discardedCaps - discardedCaps;
+  }
+}
+
+bool Tessellator::instanceUnitPrimitive(Geometry* geo)
+{
+  auto scale = getScale(geo->M_3x4);
+  auto caps = TriangulationFactory::matchingCaps(geo);
+
+  // The unit primitive is tessellated with the scale multiplied by the size of geo, which
+  // gives the same segment count as tessellating geo directly.
+  Geometry unit = *geo;
+  unit.sampleStartAngle = 0.f;
+  Mat3x4f S;
+  std::memset(&S, 0, sizeof(S));
+  float error = 0.f;
+  float unitScale = scale;
+  unsigned segments = 0;
+  switch (geo->kind) {
+  case Geometry::Kind::Box:
+    for (unsigned i = 0; i < 3; i++) {
+      if (!(1e-5f <= geo->box.lengths[i])) return false;
+      unit.box.lengths[i] = 1.f;
+      S.data[4 * i] = geo->box.lengths[i];
+    }
+    break;
+
+  case Geometry::Kind::Cylinder: {
+    auto r = geo->cylinder.radius;
+    auto h = geo->cylinder.height;
+    if (!(0.f < r && 0.f < h)) return false;
+    segments = factory->sagittaBasedSegmentCount(twopi, r, scale);
+    error = factory->sagittaBasedError(twopi, r, scale, segments);
+    unit.cylinder.radius = 1.f;
+    unit.cylinder.height = 1.f;
+    unitScale = r * scale;
+    S.cols[0] = makeVec3f(r * std::cos(geo->sampleStartAngle), r * std::sin(geo->sampleStartAngle), 0.f);
+    S.cols[1] = makeVec3f(-r * std::sin(geo->sampleStartAngle), r * std::cos(geo->sampleStartAngle), 0.f);
+    S.cols[2] = makeVec3f(0.f, 0.f, h);
+    break;
+  }
+  case Geometry::Kind::Sphere: {
+    auto r = 0.5f * geo->sphere.diameter;
+    if (!(0.f < r)) return false;
+    segments = factory->sagittaBasedSegmentCount(twopi, r, scale);
+    error = factory->sagittaBasedError(twopi, r, scale, segments);
+    unit.sphere.diameter = 2.f;
+    unitScale = r * scale;
+    S.cols[0] = makeVec3f(r * std::cos(geo->sampleStartAngle), r * std::sin(geo->sampleStartAngle), 0.f);
+    S.cols[1] = makeVec3f(-r * std::sin(geo->sampleStartAngle), r * std::cos(geo->sampleStartAngle), 0.f);
+    S.cols[2] = makeVec3f(0.f, 0.f, r);
+    break;
+  }
+  default:
+    return false;
+  }
+
+  uint64_t key = (uint64_t(1) << 63) | (uint64_t(geo->kind) << 40) | (uint64_t(caps) << 32) | segments;
+  auto * item = (UnitItem*)units.get(key);
+  if (item == nullptr) {
+    auto discardedCaps = factory->discardedCaps;
+    item = arena.alloc<UnitItem>();
+    switch (geo->kind) {
+    case Geometry::Kind::Box:
+      item->tri = factory->box(&store->arenaTriangulation, &unit, unitScale, caps);
+      break;
+    case Geometry::Kind::Cylinder:
+      item->tri = factory->cylinder(&store->arenaTriangulation, &unit, unitScale, caps);
+      break;
+    default:
+      item->tri = factory->sphereBasedShape(&store->arenaTriangulation, &unit, 1.f, pi, 0.f, 1.f, unitScale);
+      break;
+    }
+    item->discardedCaps = factory->discardedCaps - discardedCaps;
+    units.insert(key, uint64_t(item));
+    unitPrimitives++;
+  }
+  else {
+    factory->discardedCaps += item->discardedCaps;
+  }
+
+  auto * tri = store->arenaTriangulation.alloc<Triangulation>();
+  *tri = *item->tri;
+  tri->id = geo->id;
+  tri->error = error;
+  tri->instance = (const Mat3x4f*)store->arenaTriangulation.dup(&S, sizeof(S));
+  geo->triangulation = tri;
+  instanced++;
+  return true;
 }
 
 
@@ -61,7 +379,12 @@ void Tessellator::init(class Store& store_)
 {
   store = &store_;
 
-  factory = new TriangulationFactory(store, logger, tolerance, 3, maxSamples),
+  factory = new TriangulationFactory(store, logger, tolerance, 3, maxSamples);
+  if (1 < threads) {
+    for (unsigned i = 0; i < threads; i++) {
+      threadFactories.push_back(new TriangulationFactory(store, logger, tolerance, 3, maxSamples));
+    }
+  }
 
   store->arenaTriangulation.clear();
 
@@ -70,19 +393,99 @@ void Tessellator::init(class Store& store_)
 
   stack = (StackItem*)arena.alloc(sizeof(StackItem)*store->groupCountAllocated());
   stack_p = 0;
+
+  cullPass = 0.f < cullLeafThresholdScaled || 0.f < cullGeometryThresholdScaled;
 }
 
 void Tessellator::endModel()
 {
-  logger(0, "Discarded %u caps.", factory->discardedCaps);
+  if (cullPass) return;
+  tessellatePending();
+
+  std::vector<TriangulationFactory*> factories = threadFactories;
+  factories.push_back(factory);
+
+  unsigned discardedCaps = 0;
+  unsigned polygons[5] = { 0 };
+  unsigned weldedVertices = 0;
+  for (auto * f : factories) {
+    discardedCaps += f->discardedCaps;
+    weldedVertices += f->weldedVertices;
+    polygons[0] += f->trianglePolygons;
+    polygons[1] += f->quadPolygons;
+    polygons[2] += f->convexPolygons;
+    polygons[3] += f->earClippedPolygons;
+    polygons[4] += f->tessellatedPolygons;
+  }
+  logger(0, "Discarded %u caps.", discardedCaps);
+  if (polygons[0] + polygons[1] + polygons[2] + polygons[3] + polygons[4]) {
+    logger(0, "Facet group polygons: %u triangles, %u quads, %u convex, %u ear-clipped, %u by libtess2.",
+           polygons[0], polygons[1], polygons[2], polygons[3], polygons[4]);
+    logger(0, "Welded %u facet group vertices.", weldedVertices);
+  }
 }
 
+void Tessellator::tessellatePending()
+{
+  if (pending.empty()) return;
+
+  // Geometries that reuse a cached triangulation are resolved when finishing, instances are already placed.
+  std::vector<PendingItem> queue;
+  for (auto & p : pending) {
+    if (!p.instanced && (p.item == nullptr || p.item->src == p.geo)) queue.push_back(p);
+  }
+  std::stable_sort(queue.begin(), queue.end(), [](const PendingItem& a, const PendingItem& b) { return moreExpensive(a.geo, b.geo); });
+
+  // Each thread allocates from its own arena, which is handed over to the store when done.
+  std::vector<Arena> arenas(threadFactories.size());
+  std::atomic<size_t> next = 0;
+  auto worker = [&](size_t t) {
+    for (size_t i = next++; i < queue.size(); i = next++) {
+      tessellateSource(threadFactories[t], &arenas[t], queue[i].geo, queue[i].item);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < std::min(threadFactories.size(), queue.size()); t++) {
+    workers.emplace_back(worker, t);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  for (auto& threadArena : arenas) {
+    store->arenaTriangulation.adopt(threadArena);
+  }
+
+  // Finish in visiting order, as done by the single-threaded path.
+  for (auto & p : pending) {
+    if (p.item && p.item->src != p.geo) {
+      p.geo->triangulation = p.item->tri;
+      factory->discardedCaps += p.item->discardedCaps;
+    }
+    finishGeometry(p.geo);
+  }
+  pending.clear();
+}
+
+
+bool Tessellator::done()
+{
+  if (cullPass) {
+    cullPass = false;
+    return false;
+  }
+  return true;
+}
 
 void Tessellator::beginGroup(struct Node* group)
 {
   StackItem item = { 0 };
   if (!isEmpty(group->group.bboxWorld)) {
     item.groupError = diagonal(group->group.bboxWorld);
+
+    // Count only the outermost of nested groups that are culled.
+    if (cullPass && item.groupError < cullLeafThresholdScaled && (stack_p == 0 || cullLeafThresholdScaled <= stack[stack_p - 1].groupError)) {
+      leafCulled++;
+    }
   }
   stack[stack_p++] = item;
 }
@@ -102,82 +505,75 @@ void Tessellator::geometry(Geometry* geo)
     geo->triangulation = nullptr;
     return;
   }
-  processed++;
 
-  auto scale = getScale(geo->M_3x4);
+  if (cullPass) {
+    cull(geo);
+    return;
+  }
+  processed++;
 
-  // Group error less than threshold, skip tessellation and record error.
-  if (stack[stack_p - 1].groupError < cullLeafThresholdScaled) {
-    geo->triangulation = store->arenaTriangulation.alloc<Triangulation>();
-    geo->triangulation->error = stack[stack_p - 1].groupError;
+  // Culled geometries keep the empty triangulation recording their error.
+  if (geo->culled) {
     return;
   }
-  else {
-    auto scaledDiagonal = diagonal(geo->bboxWorld);
-    if (scaledDiagonal < cullGeometryThresholdScaled) {
-      geo->triangulation = store->arenaTriangulation.alloc<Triangulation>();
-      geo->triangulation->error = scaledDiagonal;
-      geometryCulled++;
-      return;
+
+  // Instancing is cheap and done on this thread, also when the rest is tessellated in parallel.
+  if (instancing && instanceUnitPrimitive(geo)) {
+    if (1 < threads) {
+      pending.push_back(PendingItem{ geo, nullptr, true });
+    }
+    else {
+      finishGeometry(geo);
     }
+    return;
   }
 
+  // Facet groups are not cached, as comparing their polygons costs about as much as tessellating them.
+  CacheItem* item = geo->kind != Geometry::Kind::FacetGroup ? getCacheItem(geo) : nullptr;
 
-  Triangulation* tri = nullptr;
-  switch (geo->kind) {
-  case Geometry::Kind::Pyramid:
-    tri = factory->pyramid(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::Box:
-    tri = factory->box(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::RectangularTorus:
-    tri = factory->rectangularTorus(&store->arenaTriangulation, geo, scale);
-    break;
-    
-  case Geometry::Kind::CircularTorus:
-    tri = factory->circularTorus(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::EllipticalDish:
-    tri = factory->sphereBasedShape(&store->arenaTriangulation, geo, geo->ellipticalDish.baseRadius, half_pi, 0.f, geo->ellipticalDish.height / geo->ellipticalDish.baseRadius, scale);
-    break;
-
-  case Geometry::Kind::SphericalDish: {
-    float r_circ = geo->sphericalDish.baseRadius;
-    auto h = geo->sphericalDish.height;
-    float r_sphere = (r_circ*r_circ + h * h) / (2.f*h);
-    float sinval = std::min(1.f, std::max(-1.f, r_circ / r_sphere));
-    float arc = asin(sinval);
-    if (r_circ < h) { arc = pi - arc; }
-    tri = factory->sphereBasedShape(&store->arenaTriangulation, geo, r_sphere, arc, h - r_sphere, 1.f, scale);
-    break;
+  if (1 < threads) {
+    pending.push_back(PendingItem{ geo, item, false });
+    return;
   }
-  case Geometry::Kind::Snout:
-    tri = factory->snout(&store->arenaTriangulation, geo, scale);
-    break;
 
-  case Geometry::Kind::Cylinder:
-    tri = factory->cylinder(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::Sphere:
-    tri = factory->sphereBasedShape(&store->arenaTriangulation, geo, 0.5f*geo->sphere.diameter, pi, 0.f, 1.f, scale);
-    break;
+  if (item && item->src != geo) {
+    geo->triangulation = item->tri;
+    factory->discardedCaps += item->discardedCaps;
+  }
+  else {
+    tessellateSource(factory, &store->arenaTriangulation, geo, item);
+  }
+  finishGeometry(geo);
+}
 
-  case Geometry::Kind::FacetGroup:
-    tri = factory->facetGroup(&store->arenaTriangulation, geo, scale);
-    break;
+void Tessellator::cull(Geometry* geo)
+{
+  // Geometries in a group below the leaf threshold record the group diagonal as error,
+  // other geometries below the geometry threshold their own diagonal.
+  float error = stack[stack_p - 1].groupError;
+  if (cullLeafThresholdScaled <= error) {
+    error = diagonal(geo->bboxWorld);
+    if (!(error < cullGeometryThresholdScaled)) {
+      geo->culled = false;
+      return;
+    }
+  }
 
-  case Geometry::Kind::Line:  // Handled at start of function.
-  default:
-    assert(false && "Unhandled primitive type");
-    break;
+  geo->culled = true;
+  geo->triangulation = store->arenaTriangulation.alloc<Triangulation>();
+  geo->triangulation->error = error;
+  geometryCulled++;
+  if (geo->kind == Geometry::Kind::FacetGroup) {
+    culledTriangles += facetGroupTriangleCount(&scratch, geo);
+  }
+  else {
+    culledTriangles += triangleCount(factory, geo, getScale(geo->M_3x4), TriangulationFactory::matchingCaps(geo));
   }
+}
 
-  geo->triangulation = tri;
+void Tessellator::finishGeometry(Geometry* geo)
+{
+  auto * tri = geo->triangulation;
   vertices += uint64_t(tri->vertices_n);
   triangles += uint64_t(tri->triangles_n);
 
@@ -193,8 +589,54 @@ void Tessellator::geometry(Geometry* geo)
   //assert(box.max[1] - 0.1f*box.maxSideLength() < geo->bbox_l.max[1]);
   //assert(box.max[2] - 0.1f*box.maxSideLength() < geo->bbox_l.max[2]);
 
-  geo->triangulation->id = geo->id;
   process(geo);
 
   tessellated++;
 }
+
+
+float toleranceForTriangleBudget(Store* store, Logger logger, uint64_t triangleBudget, float cullScale, unsigned maxSamples)
+{
+  auto time0 = std::chrono::high_resolution_clock::now();
+  BudgetCollector collector;
+  store->apply(&collector);
+
+  auto triangles = [&](float tolerance) {
+    TriangulationFactory factory(store, logger, tolerance, 3, maxSamples);
+    uint64_t sum = 0;
+    for (auto & item : collector.items) {
+      if (item.diagonal < cullScale * tolerance) continue;
+      sum += item.fixedTriangles + triangleCount(&factory, item.geo, item.scale, item.caps);
+    }
+    return sum;
+  };
+
+  // Triangle count decreases with tolerance, bisect in log space for the smallest
+  // tolerance that stays within budget.
+  float lo = 1e-6f;
+  float hi = std::max(1.f, collector.maxDiagonal);
+  uint64_t hiTriangles = triangles(hi);
+  if (triangleBudget < hiTriangles) {
+    logger(1, "Triangle budget %llu is below the %llu triangles at the coarsest tolerance %f.",
+           (unsigned long long)triangleBudget, (unsigned long long)hiTriangles, hi);
+    return hi;
+  }
+  if (triangles(lo) <= triangleBudget) {
+    return lo;
+  }
+  for (unsigned i = 0; i < 40 && lo * 1.001f < hi; i++) {
+    float mid = std::sqrt(lo * hi);
+    uint64_t midTriangles = triangles(mid);
+    if (midTriangles <= triangleBudget) {
+      hi = mid;
+      hiTriangles = midTriangles;
+    }
+    else {
+      lo = mid;
+    }
+  }
+  auto e = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
+  logger(0, "Triangle budget %llu gives tolerance %f with an estimated %llu triangles (%lldms)",
+         (unsigned long long)triangleBudget, hi, (unsigned long long)hiTriangles, e);
+  return hi;
+}
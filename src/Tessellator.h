@@ -4,6 +4,8 @@
 #include "StoreVisitor.h"
 #include "LinAlg.h"
 
+struct TESStesselator;
+
 class TriangulationFactory
 {
 public:
@@ -17,6 +19,8 @@ public:
 
   Triangulation* box(Arena* arena, const Geometry* geo, float scale);
 
+  Triangulation* box(Arena* arena, const Geometry* geo, float scale, unsigned caps);  // Leaves out the faces in caps, see matchingCaps.
+
   Triangulation* rectangularTorus(Arena* arena, const Geometry* geo, float scale);
 
   Triangulation* circularTorus(Arena* arena, const Geometry* geo, float scale);
@@ -25,12 +29,26 @@ public:
 
   Triangulation* cylinder(Arena* arena, const Geometry* geo, float scale);
 
+  Triangulation* cylinder(Arena* arena, const Geometry* geo, float scale, unsigned caps);
+
   Triangulation* facetGroup(Arena* arena, const Geometry* geo, float scale);
 
   Triangulation* sphereBasedShape(Arena* arena, const  Geometry* geo, float radius, float arc, float shift_z, float scale_z, float scale);
 
+  // Bit i is set if the cap at connection i matches the connected geometry and is left out.
+  static unsigned matchingCaps(const Geometry* geo);
+
   unsigned discardedCaps = 0;
 
+  // Facet group polygons by how they were triangulated.
+  unsigned trianglePolygons = 0;
+  unsigned quadPolygons = 0;
+  unsigned convexPolygons = 0;
+  unsigned earClippedPolygons = 0;
+  unsigned tessellatedPolygons = 0;   // By libtess2.
+
+  unsigned weldedVertices = 0;        // Facet group vertices merged with a neighbour.
+
 private:
   Store* store;
   Logger logger;
@@ -39,6 +57,7 @@ private:
   unsigned maxSamples = 100;
 
   std::vector<float> vertices;
+  std::vector<Vec2f> vec2;
   std::vector<Vec3f> vec3;
   std::vector<float> normals;
   std::vector<uint32_t> indices;
@@ -50,6 +69,30 @@ private:
   std::vector<float> t1;
   std::vector<float> t2;
 
+  Arena scratch;
+
+  // The libtess2 tessellator is reused for all polygons. It lives in tessObjectArena, while
+  // the allocations for each polygon come from tessArena, which is reset after the polygon.
+  TESStesselator* tess = nullptr;
+  Arena tessObjectArena;
+  Arena tessArena;
+  Arena* tessAllocArena = nullptr;
+
+  // Triangulates a single-contour polygon that is planar and convex by a fan, or simple and
+  // small enough by ear clipping. Returns false if libtess2 is needed.
+  bool simplePolygon(const struct Contour& cont);
+
+  // Merges facet group vertices closer than distance with similar normals, and drops the
+  // triangles that collapse.
+  void weld(float distance);
+
+  Map unitCircles;  // Tables already looked up in the shared unit circle tables, by sample count.
+
+  // Returns the shared table of samples evenly spaced around the unit circle, starting at angle 0.
+  const float* unitCircle(unsigned samples);
+
+  // Fills dst with (cos, sin) of evenly spaced angles starting at startAngle.
+  void circleSamples(std::vector<float>& dst, unsigned samples, float startAngle);
 };
 
 class Tessellator : public StoreVisitor
@@ -57,7 +100,7 @@ class Tessellator : public StoreVisitor
 public:
   Tessellator() = delete;
   Tessellator(const Tessellator&) = delete;
-  Tessellator(Logger logger, float tolerance, float cullLeafThreshold, float cullGeometryThreshold, unsigned maxSamples);
+  Tessellator(Logger logger, float tolerance, float cullLeafThreshold, float cullGeometryThreshold, unsigned maxSamples, unsigned threads = 1, bool instancing = false);
 
   Tessellator& operator=(const Tessellator&) = delete;
 
@@ -73,21 +116,39 @@ public:
 
   void endModel() override;
 
+  bool done() override;
 
-  unsigned leafCulled = 0;
-  unsigned geometryCulled = 0;
+
+  unsigned leafCulled = 0;         // Groups culled as a whole, nested groups are not counted.
+  unsigned geometryCulled = 0;     // Geometries culled, either by themselves or with their group.
+  uint64_t culledTriangles = 0;    // Estimated triangles saved by culling.
   unsigned tessellated = 0;
   unsigned processed = 0;
 
   uint64_t vertices = 0;
   uint64_t triangles = 0;
 
+  unsigned cacheLookups = 0;
+  unsigned cacheHits = 0;     // Geometries that reused the triangulation of an identical geometry.
+
+  unsigned unitPrimitives = 0;
+  unsigned instanced = 0;     // Geometries placed as an instance of a unit primitive.
+
 protected:
-  struct CacheItem
+  struct CacheKey;
+  struct CacheItem;
+
+  struct PendingItem
+  {
+    struct Geometry* geo;
+    struct CacheItem* item;   // Null if not cached.
+    bool instanced;           // Already placed as an instance of a unit primitive.
+  };
+
+  struct UnitItem
   {
-    struct CacheItem* next;
-    struct Geometry* src;
-    struct Triangulation* tri;
+    Triangulation* tri;
+    unsigned discardedCaps;   // Caps discarded when tessellating the unit primitive.
   };
 
   struct StackItem
@@ -99,12 +160,29 @@ protected:
   unsigned maxSamples = 100;
   float cullLeafThresholdScaled = 0.f / 0.f;
   float cullGeometryThresholdScaled = 0.f / 0.f;
+
+  // With culling enabled, the store is visited twice. The first pass marks the culled
+  // geometries, so that geometries connected to them keep the caps facing them.
+  bool cullPass = false;
+  Arena scratch;
+
   Arena arena;
   TriangulationFactory* factory = nullptr;
   Logger logger;
 
+  // With more than one thread, the geometries of a model are collected and tessellated when
+  // the model ends, using one factory per thread.
+  unsigned threads = 1;
+  std::vector<TriangulationFactory*> threadFactories;
+  std::vector<PendingItem> pending;
+
   Store * store = nullptr;
 
+  // Boxes, cylinders and spheres with equal caps and segment counts share one triangulation
+  // of a unit primitive, keyed on kind, caps and segment count.
+  bool instancing = false;
+  Map units;
+
   struct {
     Map map;
     CacheItem* items;
@@ -114,7 +192,22 @@ protected:
   StackItem* stack = nullptr;
   unsigned stack_p = 0;
 
-  Triangulation* getTriangulation(Geometry* geo);
+  CacheItem* getCacheItem(Geometry* geo);
+
+  bool instanceUnitPrimitive(Geometry* geo);
+
+  void cull(Geometry* geo);
+
+  static void tessellateSource(TriangulationFactory* factory, Arena* arena, Geometry* geo, CacheItem* item);
+
+  void finishGeometry(Geometry* geo);
+
+  void tessellatePending();
 
   virtual void process(Geometry* /*geometry*/) {}
-};
\ No newline at end of file
+};
+
+// Finds the smallest tolerance for which tessellating the store gives at most triangleBudget
+// triangles, estimated from the segment counts of each primitive without building meshes.
+// Geometries culled at cullScale times the tolerance do not count.
+float toleranceForTriangleBudget(Store* store, Logger logger, uint64_t triangleBudget, float cullScale, unsigned maxSamples);
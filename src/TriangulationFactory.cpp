@@ -4,10 +4,17 @@
 #include <cstdio>
 #include <cassert>
 #include <cstring>
+#include <mutex>
 #include "tesselator.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#define RVMPARSER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "Store.h"
 #include "Tessellator.h"
+#include "Parser.h"
 #include "LinAlgOps.h"
 
 namespace {
@@ -17,6 +24,15 @@ namespace {
   const float one_over_pi = float(1.0 / M_PI);
   const float twopi = float(2.0*M_PI);
 
+  // Tables of (cos, sin) of (2pi/n)*i for i in [0,n) keyed by n, shared by all factories.
+  // A table is never modified once inserted and lives until exit.
+  struct UnitCircleTables
+  {
+    std::mutex mutex;
+    Arena arena;
+    Map map;
+  } unitCircleTables;
+
   struct Interface
   {
     enum struct Kind {
@@ -214,6 +230,164 @@ namespace {
     return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
   }
 
+  const float weldDistanceFactor = 0.1f;       // Facet vertices closer than this times tolerance are welded,
+  const float weldCosCreaseAngle = 0.9396926f;  // if their normals are less than 20 degrees apart.
+
+  uint64_t weldCellKey(int64_t x, int64_t y, int64_t z)
+  {
+    auto key = (uint64_t(x) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(y) * 0xC2B2AE3D27D4EB4Full) ^ (uint64_t(z) * 0x165667B19E3779F9ull);
+    return key ? key : 1;
+  }
+
+  const unsigned earClipMaxVertices = 64;   // Larger simple polygons are left to libtess2.
+
+  // Twice the signed area of triangle o, a, b, positive if counter-clockwise.
+  inline float cross2(const Vec2f& o, const Vec2f& a, const Vec2f& b)
+  {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+  }
+
+  // Projects a contour onto the coordinate plane most orthogonal to its Newell normal, mirrored
+  // so that the contour winds counter-clockwise. Returns false if the contour has no proper
+  // normal or is not planar.
+  bool projectPlanarContour(std::vector<Vec2f>& P, const Contour& cont)
+  {
+    const unsigned n = cont.vertices_n;
+    const float* V = cont.vertices;
+
+    Vec3f N = makeVec3f(0.f);
+    BBox3f bbox = createEmptyBBox3f();
+    for (unsigned i = 0; i < n; i++) {
+      const float* a = V + 3 * i;
+      const float* b = V + 3 * ((i + 1) % n);
+      N.x += (a[1] - b[1]) * (a[2] + b[2]);
+      N.y += (a[2] - b[2]) * (a[0] + b[0]);
+      N.z += (a[0] - b[0]) * (a[1] + b[1]);
+      engulf(bbox, makeVec3f(a));
+    }
+    float l = length(N);
+    if (!(0.f < l)) return false;
+    N = (1.f / l) * N;
+
+    auto c = makeVec3f(V);
+    auto planarTolerance = 1e-3f * diagonal(bbox);
+    for (unsigned i = 1; i < n; i++) {
+      if (planarTolerance < std::abs(dot(N, makeVec3f(V + 3 * i) - c))) return false;
+    }
+
+    unsigned k = 0;
+    if (std::abs(N.data[k]) < std::abs(N.data[1])) k = 1;
+    if (std::abs(N.data[k]) < std::abs(N.data[2])) k = 2;
+    unsigned u = (k + 1) % 3;
+    unsigned v = (k + 2) % 3;
+    if (N.data[k] < 0.f) std::swap(u, v);
+
+    P.resize(n);
+    for (unsigned i = 0; i < n; i++) {
+      P[i] = makeVec2f(V[3 * i + u], V[3 * i + v]);
+    }
+    return true;
+  }
+
+  // Counter-clockwise contour without reflex vertices that winds around once.
+  bool isConvex(const std::vector<Vec2f>& P)
+  {
+    const size_t n = P.size();
+    unsigned flips = 0;
+    int firstSign = 0;
+    int prevSign = 0;
+    for (size_t i = 0; i < n; i++) {
+      const auto & a = P[i];
+      const auto & b = P[(i + 1) % n];
+      if (cross2(a, b, P[(i + 2) % n]) < 0.f) return false;
+
+      // Direction in x changes exactly twice when winding around once.
+      int sign = a.x < b.x ? 1 : (b.x < a.x ? -1 : 0);
+      if (sign == 0) continue;
+      if (firstSign == 0) firstSign = sign;
+      if (prevSign != 0 && prevSign != sign) flips++;
+      prevSign = sign;
+    }
+    if (prevSign != firstSign) flips++;
+    return flips <= 2;
+  }
+
+  bool onSegment(const Vec2f& a, const Vec2f& b, const Vec2f& p)
+  {
+    return std::min(a.x, b.x) <= p.x && p.x <= std::max(a.x, b.x) &&
+           std::min(a.y, b.y) <= p.y && p.y <= std::max(a.y, b.y);
+  }
+
+  bool segmentsIntersect(const Vec2f& a, const Vec2f& b, const Vec2f& c, const Vec2f& d)
+  {
+    auto d1 = cross2(a, b, c);
+    auto d2 = cross2(a, b, d);
+    auto d3 = cross2(c, d, a);
+    auto d4 = cross2(c, d, b);
+    if (((0.f < d1 && d2 < 0.f) || (d1 < 0.f && 0.f < d2)) &&
+        ((0.f < d3 && d4 < 0.f) || (d3 < 0.f && 0.f < d4))) return true;
+    return (d1 == 0.f && onSegment(a, b, c)) || (d2 == 0.f && onSegment(a, b, d)) ||
+           (d3 == 0.f && onSegment(c, d, a)) || (d4 == 0.f && onSegment(c, d, b));
+  }
+
+  // No repeated vertices and no edges that touch except at shared endpoints of neighbours.
+  bool isSimple(const std::vector<Vec2f>& P)
+  {
+    const size_t n = P.size();
+    for (size_t i = 0; i < n; i++) {
+      const auto & a = P[i];
+      const auto & b = P[(i + 1) % n];
+      if (a.x == b.x && a.y == b.y) return false;
+      for (size_t j = i + 2; j < n; j++) {
+        if (i == 0 && j + 1 == n) continue;
+        if (segmentsIntersect(a, b, P[j], P[(j + 1) % n])) return false;
+      }
+    }
+    return true;
+  }
+
+  // Ear clipping of a simple counter-clockwise contour. Returns false if no ear is found, which
+  // can happen on numerically degenerate input.
+  bool clipEars(std::vector<uint32_t>& triangles, std::vector<uint32_t>& R, const std::vector<Vec2f>& P)
+  {
+    auto m = unsigned(P.size());
+    R.resize(m);
+    for (unsigned i = 0; i < m; i++) R[i] = i;
+
+    unsigned i = 0;
+    unsigned misses = 0;
+    while (3 < m) {
+      if (m <= misses) return false;
+
+      auto a = R[(i + m - 1) % m];
+      auto b = R[i];
+      auto c = R[(i + 1) % m];
+      bool ear = 0.f < cross2(P[a], P[b], P[c]);
+      for (unsigned k = 0; ear && k < m; k++) {
+        auto r = R[k];
+        if (r == a || r == b || r == c) continue;
+        if (0.f <= cross2(P[a], P[b], P[r]) && 0.f <= cross2(P[b], P[c], P[r]) && 0.f <= cross2(P[c], P[a], P[r])) ear = false;
+      }
+      if (ear) {
+        triangles.push_back(a);
+        triangles.push_back(b);
+        triangles.push_back(c);
+        R.erase(R.begin() + i);
+        m--;
+        if (m <= i) i = 0;
+        misses = 0;
+      }
+      else {
+        i = (i + 1) % m;
+        misses++;
+      }
+    }
+    triangles.push_back(R[0]);
+    triangles.push_back(R[1]);
+    triangles.push_back(R[2]);
+    return true;
+  }
+
   unsigned triIndices(uint32_t* indices, unsigned  l, unsigned o, unsigned v0, unsigned v1, unsigned v2)
   {
     indices[l++] = o + v0;
@@ -251,6 +425,56 @@ namespace {
     return l;
   }
 
+#ifdef RVMPARSER_USE_SSE2
+
+  // Store the x, y and z lanes of 4 vectors as 12 consecutive floats.
+  void storeXYZ4(float* dst, __m128 x, __m128 y, __m128 z)
+  {
+    __m128 xy_lo = _mm_unpacklo_ps(x, y);   // x0 y0 x1 y1
+    __m128 xy_hi = _mm_unpackhi_ps(x, y);   // x2 y2 x3 y3
+    __m128 yz_lo = _mm_unpacklo_ps(y, z);   // y0 z0 y1 z1
+    __m128 yz_hi = _mm_unpackhi_ps(y, z);   // y2 z2 y3 z3
+    __m128 zx_lo = _mm_unpacklo_ps(z, x);   // z0 x0 z1 x1
+    __m128 zx_hi = _mm_unpackhi_ps(z, x);   // z2 x2 z3 x3
+    _mm_storeu_ps(dst + 0, _mm_shuffle_ps(xy_lo, zx_lo, _MM_SHUFFLE(3, 0, 1, 0)));  // x0 y0 z0 x1
+    _mm_storeu_ps(dst + 4, _mm_shuffle_ps(yz_lo, xy_hi, _MM_SHUFFLE(1, 0, 3, 2)));  // y1 z1 x2 y2
+    _mm_storeu_ps(dst + 8, _mm_shuffle_ps(zx_hi, yz_hi, _MM_SHUFFLE(3, 2, 3, 0)));  // z2 x3 y3 z3
+  }
+
+  // Split 4 interleaved (cos, sin) samples into a cos and a sin vector.
+  void loadCosSin4(__m128& c, __m128& s, const float* src)
+  {
+    __m128 a = _mm_loadu_ps(src);
+    __m128 b = _mm_loadu_ps(src + 4);
+    c = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    s = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+  }
+
+#endif
+
+  // libtess2 allocator on top of the arena that userData points to, where free is a no-op and
+  // memory is released by resetting the arena. Blocks are prefixed by their size for realloc.
+  void* tessArenaAlloc(void* userData, unsigned size)
+  {
+    auto * arena = *(Arena**)userData;
+    auto * block = (size_t*)arena->alloc(sizeof(size_t) + size);
+    block[0] = size;
+    return block + 1;
+  }
+
+  void* tessArenaRealloc(void* userData, void* ptr, unsigned size)
+  {
+    auto * rv = tessArenaAlloc(userData, size);
+    if (ptr) {
+      std::memcpy(rv, ptr, std::min(size_t(size), ((size_t*)ptr)[-1]));
+    }
+    return rv;
+  }
+
+  void tessArenaFree(void* /*userData*/, void* /*ptr*/)
+  {
+  }
+
   unsigned tessellateCircle(uint32_t* indices, unsigned  l, uint32_t* t, uint32_t* src, unsigned N)
   {
     while (3 <= N) {
@@ -285,6 +509,76 @@ TriangulationFactory::TriangulationFactory(Store* store, Logger logger, float to
 }
 
 
+unsigned TriangulationFactory::matchingCaps(const Geometry* geo)
+{
+  unsigned sides = 2;
+  auto flags = Connection::Flags::HasCircularSide;
+  switch (geo->kind) {
+  case Geometry::Kind::Pyramid:
+  case Geometry::Kind::Box:
+    sides = 6;
+    flags = Connection::Flags::HasRectangularSide;
+    break;
+  case Geometry::Kind::RectangularTorus:
+    flags = Connection::Flags::HasRectangularSide;
+    break;
+  case Geometry::Kind::CircularTorus:
+  case Geometry::Kind::Snout:
+  case Geometry::Kind::Cylinder:
+    break;
+  default:
+    return 0;
+  }
+
+  unsigned caps = 0;
+  for (unsigned i = 0; i < sides; i++) {
+    auto * con = geo->connections[i];
+    if (con && con->flags == flags && !con->geo[con->geo[0] == geo ? 1 : 0]->culled && doInterfacesMatch(geo, con)) {
+      caps |= 1u << i;
+    }
+  }
+  return caps;
+}
+
+const float* TriangulationFactory::unitCircle(unsigned samples)
+{
+  assert(samples);
+  if (auto * table = (const float*)unitCircles.get(samples)) {
+    return table;
+  }
+
+  std::lock_guard<std::mutex> lock(unitCircleTables.mutex);
+  auto * table = (float*)unitCircleTables.map.get(samples);
+  if (table == nullptr) {
+    table = (float*)unitCircleTables.arena.alloc(2 * sizeof(float) * samples);
+    for (unsigned i = 0; i < samples; i++) {
+      table[2 * i + 0] = std::cos((twopi / samples)*i);
+      table[2 * i + 1] = std::sin((twopi / samples)*i);
+    }
+    unitCircleTables.map.insert(samples, uint64_t(table));
+  }
+  unitCircles.insert(samples, uint64_t(table));
+  return table;
+}
+
+void TriangulationFactory::circleSamples(std::vector<float>& dst, unsigned samples, float startAngle)
+{
+  auto * table = unitCircle(samples);
+  dst.resize(2 * samples);
+  if (startAngle == 0.f) {
+    std::memcpy(dst.data(), table, 2 * sizeof(float) * samples);
+    return;
+  }
+
+  // Rotate the table instead of evaluating cos and sin of each offset angle.
+  auto c = std::cos(startAngle);
+  auto s = std::sin(startAngle);
+  for (unsigned i = 0; i < samples; i++) {
+    dst[2 * i + 0] = c * table[2 * i + 0] - s * table[2 * i + 1];
+    dst[2 * i + 1] = s * table[2 * i + 0] + c * table[2 * i + 1];
+  }
+}
+
 unsigned TriangulationFactory::sagittaBasedSegmentCount(float arc, float radius, float scale)
 {
   float samples = arc / std::acos(std::max(-1.f, 1.f - tolerance / (scale*radius)));
@@ -415,7 +709,12 @@ Triangulation* TriangulationFactory::pyramid(Arena* arena, const Geometry* geo,
 }
 
 
-Triangulation* TriangulationFactory::box(Arena* arena, const Geometry* geo, float /*scale*/)
+Triangulation* TriangulationFactory::box(Arena* arena, const Geometry* geo, float scale)
+{
+  return box(arena, geo, scale, matchingCaps(geo));
+}
+
+Triangulation* TriangulationFactory::box(Arena* arena, const Geometry* geo, float /*scale*/, unsigned caps)
 {
   auto & box = geo->box;
 
@@ -450,15 +749,10 @@ Triangulation* TriangulationFactory::box(Arena* arena, const Geometry* geo, floa
     1e-5 <= box.lengths[2],
   };
   for (unsigned i = 0; i < 6; i++) {
-    auto * con = geo->connections[i];
-    if (faces[i] == false || con == nullptr || con->flags != Connection::Flags::HasRectangularSide) continue;
-
-    if (doInterfacesMatch(geo, con)) {
+    if (faces[i] && (caps & (1u << i))) {
       faces[i] = false;
       discardedCaps++;
-      //store->addDebugLine(con->p.data, (con->p.data + 0.05f*con->d).data, 0xff0000);
     }
-
   }
 
   unsigned faces_n = 0;
@@ -673,11 +967,7 @@ Triangulation* TriangulationFactory::circularTorus(Arena* arena, const Geometry*
     t0[2 * i + 1] = std::sin((ct.angle / (samples_l - 1.f))*i);
   }
 
-  t1.resize(2 * samples_s);
-  for (unsigned i = 0; i < samples_s; i++) {
-    t1[2 * i + 0] = std::cos((twopi / samples_s)*i + geo->sampleStartAngle);
-    t1[2 * i + 1] = std::sin((twopi / samples_s)*i + geo->sampleStartAngle);
-  }
+  circleSamples(t1, samples_s, geo->sampleStartAngle);
 
 
   tri->vertices_n = ((shell ? samples_l : 0) + (cap[0] ? 1 : 0) + (cap[1] ? 1 : 0)) * samples_s;
@@ -698,7 +988,21 @@ Triangulation* TriangulationFactory::circularTorus(Arena* arena, const Geometry*
     //        (ct.radius * cos(twopi *v) + ct.offset) * sin(ct.angle * u),
     //        ct.radius * sin(twopi *v));
     for (unsigned u = 0; u < samples_l; u++) {
-      for (unsigned v = 0; v < samples_s; v++) {
+      unsigned v = 0;
+#ifdef RVMPARSER_USE_SSE2
+      const __m128 cu = _mm_set1_ps(t0[2 * u + 0]);
+      const __m128 su = _mm_set1_ps(t0[2 * u + 1]);
+      const __m128 r = _mm_set1_ps(ct.radius);
+      const __m128 o = _mm_set1_ps(ct.offset);
+      for (; v + 4 <= samples_s; v += 4, l += 12) {
+        __m128 cv, sv;
+        loadCosSin4(cv, sv, t1.data() + 2 * v);
+        __m128 w = _mm_add_ps(_mm_mul_ps(r, cv), o);
+        storeXYZ4(tri->normals + l, _mm_mul_ps(cv, cu), _mm_mul_ps(cv, su), sv);
+        storeXYZ4(tri->vertices + l, _mm_mul_ps(w, cu), _mm_mul_ps(w, su), _mm_mul_ps(r, sv));
+      }
+#endif
+      for (; v < samples_s; v++) {
         tri->normals[l] = t1[2 * v + 0] * t0[2 * u + 0]; tri->vertices[l++] = ((ct.radius * t1[2 * v + 0] + ct.offset) * t0[2 * u + 0]);
         tri->normals[l] = t1[2 * v + 0] * t0[2 * u + 1]; tri->vertices[l++] = ((ct.radius * t1[2 * v + 0] + ct.offset) * t0[2 * u + 1]);
         tri->normals[l] = t1[2 * v + 1];                 tri->vertices[l++] = ct.radius * t1[2 * v + 1];
@@ -800,11 +1104,7 @@ Triangulation* TriangulationFactory::snout(Arena* arena, const Geometry* geo, fl
     }
   }
 
-  t0.resize(2 * samples);
-  for (unsigned i = 0; i < samples; i++) {
-    t0[2 * i + 0] = std::cos((twopi / samples)*i + geo->sampleStartAngle);
-    t0[2 * i + 1] = std::sin((twopi / samples)*i + geo->sampleStartAngle);
-  }
+  circleSamples(t0, samples, geo->sampleStartAngle);
   t1.resize(2 * samples);
   for (unsigned i = 0; i < 2 * samples; i++) {
     t1[i] = sn.radius_b * t0[i];
@@ -905,6 +1205,11 @@ Triangulation* TriangulationFactory::snout(Arena* arena, const Geometry* geo, fl
 
 
 Triangulation* TriangulationFactory::cylinder(Arena* arena, const Geometry* geo, float scale)
+{
+  return cylinder(arena, geo, scale, matchingCaps(geo));
+}
+
+Triangulation* TriangulationFactory::cylinder(Arena* arena, const Geometry* geo, float scale, unsigned caps)
 {
   //if (cullTiny && cy.radius*scale < tolerance) {
   //  tri->error = cy.radius * scale;
@@ -920,15 +1225,9 @@ Triangulation* TriangulationFactory::cylinder(Arena* arena, const Geometry* geo,
   bool shell = true;
   bool cap[2] = { true, true };
   for (unsigned i = 0; i < 2; i++) {
-    auto * con = geo->connections[i];
-    if (con && con->flags == Connection::Flags::HasCircularSide) {
-      if (doInterfacesMatch(geo, con)) {
-        cap[i] = false;
-        discardedCaps++;
-      }
-      else {
-        //store->addDebugLine(con->p.data, (con->p.data + 0.05f*con->d).data, 0x00ffff);
-      }
+    if (caps & (1u << i)) {
+      cap[i] = false;
+      discardedCaps++;
     }
   }
 
@@ -939,11 +1238,7 @@ Triangulation* TriangulationFactory::cylinder(Arena* arena, const Geometry* geo,
   tri->triangles_n = (shell ? 2 * samples : 0) + (cap[0] ? samples - 2 : 0) + (cap[1] ? samples - 2 : 0);
   tri->indices = (uint32_t*)arena->alloc(3 * sizeof(uint32_t)*tri->triangles_n);
 
-  t0.resize(2 * samples);
-  for (unsigned i = 0; i < samples; i++) {
-    t0[2 * i + 0] = std::cos((twopi / samples)*i + geo->sampleStartAngle);
-    t0[2 * i + 1] = std::sin((twopi / samples)*i + geo->sampleStartAngle);
-  }
+  circleSamples(t0, samples, geo->sampleStartAngle);
   t1.resize(2 * samples);
   for (unsigned i = 0; i < 2 * samples; i++) {
     t1[i] = cy.radius * t0[i];
@@ -1057,11 +1352,10 @@ Triangulation* TriangulationFactory::sphereBasedShape(Arena* arena, const Geomet
     auto w = t0[2 * r + 1];
     auto n = u0[r];
 
-    auto phi_scale = twopi / n;
+    circleSamples(t1, n, geo->sampleStartAngle);
     for (unsigned i = 0; i < n; i++) {
-      auto phi = phi_scale * i + geo->sampleStartAngle;
-      auto nx = w * std::cos(phi);
-      auto ny = w * std::sin(phi);
+      auto nx = w * t1[2 * i + 0];
+      auto ny = w * t1[2 * i + 1];
       l = vertex(tri->normals, tri->vertices, l, nx, ny, nz / scale_z, radius*nx, radius*ny, z);
     }
   }
@@ -1127,15 +1421,127 @@ Triangulation* TriangulationFactory::sphereBasedShape(Arena* arena, const Geomet
 }
 
 
-Triangulation* TriangulationFactory::facetGroup(Arena* arena, const Geometry* geo, float /*scale*/)
+bool TriangulationFactory::simplePolygon(const Contour& cont)
+{
+  if (!projectPlanarContour(vec2, cont)) return false;
+
+  u2.clear();
+  if (isConvex(vec2)) {
+    for (uint32_t i = 1; i + 1 < cont.vertices_n; i++) {
+      if (cross2(vec2[0], vec2[i], vec2[i + 1]) == 0.f) continue;  // Skip collinear slivers.
+      u2.push_back(0);
+      u2.push_back(i);
+      u2.push_back(i + 1);
+    }
+    convexPolygons++;
+  }
+  else if (cont.vertices_n <= earClipMaxVertices && isSimple(vec2) && clipEars(u2, u1, vec2)) {
+    earClippedPolygons++;
+  }
+  else {
+    return false;
+  }
+
+  auto vo = uint32_t(vertices.size()) / 3;
+  vertices.resize(vertices.size() + 3 * cont.vertices_n);
+  normals.resize(vertices.size());
+  std::memcpy(vertices.data() + 3 * vo, cont.vertices, 3 * sizeof(float) * cont.vertices_n);
+  std::memcpy(normals.data() + 3 * vo, cont.normals, 3 * sizeof(float) * cont.vertices_n);
+  for (auto ix : u2) {
+    indices.push_back(vo + ix);
+  }
+  return true;
+}
+
+void TriangulationFactory::weld(float distance)
+{
+  const auto n = uint32_t(vertices.size() / 3);
+  const auto cellScale = 1.0 / distance;
+  if (n < 2 || !std::isfinite(cellScale)) return;
+
+  // Hash grid with cells the size of the weld distance, where the map holds one plus the
+  // index of the first vertex of each cell and u2 links the rest. Cells that hash to the
+  // same key share a chain, which only costs extra distance tests.
+  Map grid;
+  u1.resize(n);   // Old to new vertex index.
+  u2.resize(n);
+  const auto distance2 = distance * distance;
+  uint32_t m = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    auto p = makeVec3f(vertices.data() + 3 * i);
+    auto nrm = makeVec3f(normals.data() + 3 * i);
+
+    // A vertex without a proper normal would pass the crease test against any normal, and
+    // is neither welded nor kept in the grid.
+    auto lnrm = length(nrm);
+    bool inGrid = 0.f < lnrm;
+    int64_t c[3];
+    for (unsigned k = 0; k < 3; k++) {
+      auto t = std::floor(cellScale * p.data[k]);
+      inGrid = inGrid && std::abs(t) < 1e15;
+      c[k] = inGrid ? int64_t(t) : 0;
+    }
+
+    uint32_t found = ~0u;
+    for (int dz = -1; inGrid && found == ~0u && dz <= 1; dz++) {
+      for (int dy = -1; found == ~0u && dy <= 1; dy++) {
+        for (int dx = -1; found == ~0u && dx <= 1; dx++) {
+          for (auto j = uint32_t(grid.get(weldCellKey(c[0] + dx, c[1] + dy, c[2] + dz))); j != 0; j = u2[j - 1]) {
+            auto q = makeVec3f(vertices.data() + 3 * (j - 1));
+            auto nq = makeVec3f(normals.data() + 3 * (j - 1));
+            if (distanceSquared(p, q) <= distance2 && weldCosCreaseAngle * lnrm * length(nq) <= dot(nrm, nq)) {
+              found = j - 1;
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    if (found != ~0u) {
+      u1[i] = found;
+      continue;
+    }
+
+    // Compact in place, vertices below m are final.
+    write(vertices.data() + 3 * m, p);
+    write(normals.data() + 3 * m, nrm);
+    u1[i] = m;
+    if (inGrid) {
+      auto key = weldCellKey(c[0], c[1], c[2]);
+      u2[m] = uint32_t(grid.get(key));
+      grid.insert(key, uint64_t(m) + 1);
+    }
+    m++;
+  }
+  weldedVertices += n - m;
+  vertices.resize(3 * size_t(m));
+  normals.resize(3 * size_t(m));
+
+  // Remap indices and drop triangles that collapsed.
+  size_t l = 0;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    auto a = u1[indices[i + 0]];
+    auto b = u1[indices[i + 1]];
+    auto c = u1[indices[i + 2]];
+    if (a == b || b == c || c == a) continue;
+    indices[l++] = a;
+    indices[l++] = b;
+    indices[l++] = c;
+  }
+  indices.resize(l);
+}
+
+Triangulation* TriangulationFactory::facetGroup(Arena* arena, const Geometry* geo, float scale)
 {
   auto & fg = geo->facetGroup;
+  const Polygon* polygons = facetGroupPolygons(&scratch, geo);
 
   vertices.clear();
   normals.clear();
   indices.clear();
   for (size_t p = 0; p < fg.polygons_n; p++) {
-    const Polygon& poly = fg.polygons[p];
+    const Polygon& poly = polygons[p];
 
     // Verify that all vertices is composed of finite numbers, otherwise skip polygon.
     for (size_t c = 0; c < poly.contours_n; c++) {
@@ -1161,6 +1567,7 @@ Triangulation* TriangulationFactory::facetGroup(Arena* arena, const Geometry* ge
       indices.push_back(vo + 0);
       indices.push_back(vo + 1);
       indices.push_back(vo + 2);
+      trianglePolygons++;
     }
     else if (poly.contours_n == 1 && poly.contours[0].vertices_n == 4) {
       auto & cont = poly.contours[0];
@@ -1205,8 +1612,13 @@ Triangulation* TriangulationFactory::facetGroup(Arena* arena, const Geometry* ge
         indices.push_back(vo + 2);
         indices.push_back(vo + 3);
       }
+      quadPolygons++;
+    }
+    else if (poly.contours_n == 1 && simplePolygon(poly.contours[0])) {
+      // Convex or simple polygon, triangulated without libtess2.
     }
     else  {
+      tessellatedPolygons++;
 
       bool anyData = false;
 
@@ -1219,7 +1631,20 @@ Triangulation* TriangulationFactory::facetGroup(Arena* arena, const Geometry* ge
       }
       auto m = 0.5f*(Vec3f(bbox.min) + Vec3f(bbox.max));
 
-      auto tess = tessNewTess(nullptr);
+      if (tess == nullptr) {
+        TESSalloc alloc;
+        std::memset(&alloc, 0, sizeof(alloc));
+        alloc.memalloc = tessArenaAlloc;
+        alloc.memrealloc = tessArenaRealloc;
+        alloc.memfree = tessArenaFree;
+        alloc.userData = &tessAllocArena;
+
+        tessObjectArena.clear();
+        tessAllocArena = &tessObjectArena;
+        tess = tessNewTess(&alloc);
+        tessAllocArena = &tessArena;
+      }
+
       for (unsigned c = 0; c < poly.contours_n; c++) {
         auto & cont = poly.contours[c];
         if (cont.vertices_n < 3) {
@@ -1282,16 +1707,22 @@ Triangulation* TriangulationFactory::facetGroup(Arena* arena, const Geometry* ge
             }
           }
         }
+        else {
+          // A failed tessellation leaves the mesh behind, start over with a new tessellator.
+          tess = nullptr;
+        }
       }
 
-      tessDeleteTess(tess);
+      tessArena.reset();
     }
 
   skip_polygon:
     ;
   }
+  scratch.reset();
 
   assert(vertices.size() == normals.size());
+  weld(weldDistanceFactor * tolerance / scale);
 
   Triangulation* tri = arena->alloc<Triangulation>();
   tri->error = 0.f;
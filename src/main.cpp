@@ -1,19 +1,3 @@
-#ifdef _WIN32
-
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <Windows.h>
-
-#else
-
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/mman.h>
-
-#endif
-
 #include <cstdio>
 #include <cassert>
 #include <cstdarg>
@@ -22,8 +6,15 @@
 #include <cctype>
 #include <chrono>
 #include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
 
 #include "Parser.h"
+#include "RVMIndex.h"
 #include "Tessellator.h"
 #include "ExportObj.h"
 #include "Store.h"
@@ -37,6 +28,10 @@
 
 void logger(unsigned level, const char* msg, ...)
 {
+  // Parser threads may log concurrently, keep lines from interleaving.
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+
   switch (level) {
   case 0: fprintf(stderr, "[I] "); break;
   case 1: fprintf(stderr, "[W] "); break;
@@ -52,76 +47,16 @@ void logger(unsigned level, const char* msg, ...)
 
 template<typename F>
 bool
-processFile(const std::string& path, F f)
+processFile(const std::string& path, F f, bool sequential = true)
 {
-  bool rv = false;
-#ifdef _WIN32
+  MappedFile file;
+  if (!file.map(logger, path.c_str(), sequential)) return false;
 
-  HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-  if (h == INVALID_HANDLE_VALUE) {
-    logger(2, "CreateFileA returned INVALID_HANDLE_VALUE");
+  bool rv = f(file.ptr, file.size);
+  if (!file.unmap(logger)) {
+    logger(2, "%s: failed to unmap file", path.c_str());
     rv = false;
   }
-  else {
-    DWORD hiSize;
-    DWORD loSize = GetFileSize(h, &hiSize);
-    size_t fileSize = (size_t(hiSize) << 32u) + loSize;
-
-    HANDLE m = CreateFileMappingA(h, 0, PAGE_READONLY, 0, 0, NULL);
-    if (m == INVALID_HANDLE_VALUE) {
-      logger(2, "CreateFileMappingA returned INVALID_HANDLE_VALUE");
-      rv = false;
-    }
-    else {
-      const void * ptr = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
-      if (ptr == nullptr) {
-        logger(2, "MapViewOfFile returned INVALID_HANDLE_VALUE");
-        rv = false;
-      }
-      else {
-        rv = f(ptr, fileSize);
-        UnmapViewOfFile(ptr);
-      }
-      CloseHandle(m);
-    }
-    CloseHandle(h);
-  }
-
-#else
-
-  int fd = open(path.c_str(), O_RDONLY);
-  if(fd == -1) {
-    logger(2, "%s: open failed: %s", path.c_str(), strerror(errno));
-  }
-  else {
-    struct stat stat{};
-    if(fstat(fd, &stat) != 0) {
-      logger(2, "%s: fstat failed: %s", path.c_str(), strerror(errno));
-    }
-    else {
-
-#ifdef __linux__
-      void * ptr = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
-#else
-      void * ptr = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-#endif
-      if(ptr == MAP_FAILED) {
-        logger(2, "%s: mmap failed: %s", path.c_str(), strerror(errno));
-      }
-      else {
-        if(madvise(ptr, stat.st_size, MADV_SEQUENTIAL) != 0) {
-          logger(1, "%s: madvise(MADV_SEQUENTIAL) failed: %s", path.c_str(), strerror(errno));
-        }
-        rv = f(ptr, stat.st_size);
-        if(munmap(ptr, stat.st_size) != 0) {
-          logger(2, "%s: munmap failed: %s", path.c_str(), strerror(errno));
-          rv = false;
-        }
-      }
-    }
-  }
-
-#endif
   return rv;
 }
 
@@ -144,8 +79,9 @@ Options:
                                       with a child in this list will be merged with the first
                                       parent that should be kept.
   --discard-groups=filename.txt       Provide a list of group names to discard, one name per line.
-                                      Groups with its name in this list will be discarded along
-                                      with its children. Default is no groups are discarded.
+                                      Groups with its name in this list will be skipped along
+                                      with its children while parsing the input files. Default is
+                                      no groups are discarded.
   --output-json=<filename.json>       Write hierarchy with attributes to a json file.
   --output-txt=<filename.txt>         Dump all group names to a text file.
   --output-rev=filename.rev           Write database as a text review file.
@@ -168,6 +104,10 @@ Options:
                                       of having a dummy holder node to hold each geometry piece.
                                       This transform geometries into common frames, disable this to
                                       avoid that. Default value is true.
+  --output-gltf-share-seams=<bool>    If true, merged geometries that are connected share the
+                                      vertices where they meet when positions and normals agree,
+                                      like along pipes of cylinders and tori, which gives fewer
+                                      vertices and closed meshes. Default value is false.
   --output-gltf-split-level=<uint>    Specify a level in the hierarchy to split the output into
                                       multiple files, where 0 implies no split. Geometries and
                                       attributes below the split point are included in the first
@@ -177,15 +117,285 @@ Options:
   --color-attribute=key               Specify which attributes that contain color, empty key
                                       implies that material id of group is used.
   --tolerance=value                   Tessellation tolerance, given in world frame. Default value
-                                      is 0.1.
+                                      is 0.1. Facet group vertices closer than a tenth of the
+                                      tolerance with normals less than 20 degrees apart are
+                                      always welded into one.
+  --triangle-budget=<uint>            Choose the tessellation tolerance such that the output has
+                                      at most about this many triangles, overriding --tolerance.
+                                      The count is estimated from the segment count of each
+                                      primitive before tessellating.
   --cull-scale=value                  Cull objects smaller than cull-scale times tolerance. Set to
                                       a negative value to disable culling. Disabled by default.
+                                      Groups and geometries are measured by the diagonal of their
+                                      world bounding box, culled geometries are left out of all
+                                      exports.
+  --instance-primitives               Tessellate boxes, cylinders and spheres once per segment count
+                                      and set of discarded caps as unit primitives, which each
+                                      geometry places with its own matrix. GLTF output shares the
+                                      mesh between such geometries when geometries are not merged,
+                                      while obj output expands them.
+  --threads=<uint>                    Number of threads used to parse input files, connect and
+                                      align geometries and tessellate, where 0 implies the number
+                                      of hardware threads. Multiple rvm files are parsed
+                                      concurrently, while a single rvm file is split into subtrees
+                                      and an att file into top-level blocks that are parsed
+                                      concurrently. Top-level groups are connected and connected
+                                      components aligned concurrently. The result is identical to
+                                      a single-threaded run. Default value is 1.
+  --lazy-facet-groups                 Decode facet groups from the memory-mapped rvm files when
+                                      needed instead of while parsing, keeping the files mapped.
+                                      Reduces memory usage on models dominated by facet groups.
+  --build-index                       Write an index next to each rvm file with the suffix .rvmidx,
+                                      holding byte range and bounding box of each group and the
+                                      line range of its block in the att file with the same name.
+                                      Exits after writing the indices.
+  --bbox=x0,y0,z0,x1,y1,z1            Skip groups with all geometry outside this bounding box in
+                                      the world frame while parsing. The indices are used to avoid
+                                      reading skipped groups. Rvm files are scanned first if their
+                                      index is missing, or was built from files of another size,
+                                      write time or start and end.
 
 Post bug reports or questions at https://github.com/cdyk/rvmparser
 )help", argv0);
   }
 
 
+  struct InputFile
+  {
+    std::string path;
+    Store* store = nullptr;   // Per-file store filled by a parser thread.
+    std::vector<SkipRange> skip;  // Groups outside bounding box filter.
+    bool isRVM = false;
+    bool parsed = false;
+    bool success = false;
+  };
+
+  bool parseAttFile(Store* store, const InputFile& file, unsigned threads, const DiscardList* discard)
+  {
+    auto parse = [store, &file, threads, discard](const void* ptr, size_t size) { return parseAtt(store, logger, ptr, size, false, discard, file.skip.data(), file.skip.size(), threads); };
+    if (processFile(file.path, parse, file.skip.empty())) {
+      fprintf(stderr, "Successfully parsed %s\n", file.path.c_str());
+      return true;
+    }
+    else {
+      fprintf(stderr, "Failed to parse %s\n", file.path.c_str());
+      return false;
+    }
+  }
+
+  bool parseRVMFile(Store* store, const InputFile& file, unsigned threads, bool lazyFacetGroups, DiscardList* discard)
+  {
+    // Only touch the pages of the file that are not skipped.
+    const bool sequential = file.skip.empty();
+    if (!lazyFacetGroups) {
+      auto parse = [store, &file, threads, discard](const void* ptr, size_t size) { return parseRVM(store, logger, file.path.c_str(), ptr, size, threads, false, discard, file.skip.data(), file.skip.size()); };
+      return processFile(file.path, parse, sequential);
+    }
+
+    // Facet groups reference the mapped file, so the store keeps it mapped.
+    auto * mapped = new MappedFile();
+    if (!mapped->map(logger, file.path.c_str(), sequential)) {
+      delete mapped;
+      return false;
+    }
+    store->keepMapped(mapped);
+    return parseRVM(store, logger, file.path.c_str(), mapped->ptr, mapped->size, threads, true, discard, file.skip.data(), file.skip.size());
+  }
+
+  // Files are parsed one after the other, using threads within each rvm file.
+  bool parseInputFilesSerial(Store* store, std::vector<InputFile>& files, unsigned threads, bool lazyFacetGroups, DiscardList* discard)
+  {
+    for (auto& file : files) {
+      if (file.isRVM) {
+        if (parseRVMFile(store, file, threads, lazyFacetGroups, discard)) {
+          fprintf(stderr, "Successfully parsed %s\n", file.path.c_str());
+        }
+        else {
+          fprintf(stderr, "Failed to parse %s: %s\n", file.path.c_str(), store->errorString());
+          return false;
+        }
+      }
+      else if (!parseAttFile(store, file, threads, discard)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // RVM files are parsed concurrently into per-file stores, while the main thread appends
+  // these stores in argument order and applies attribute files in between, so the result
+  // is identical to the serial path.
+  bool parseInputFilesParallel(Store* store, std::vector<InputFile>& files, unsigned threads, bool lazyFacetGroups, DiscardList* discard)
+  {
+    std::vector<InputFile*> rvmFiles;
+    for (auto& file : files) {
+      if (file.isRVM) rvmFiles.push_back(&file);
+    }
+
+    std::mutex mutex;
+    std::condition_variable parsed;
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> abort = false;
+
+    auto worker = [&]() {
+      for (size_t i = next++; i < rvmFiles.size() && !abort; i = next++) {
+        auto* file = rvmFiles[i];
+        auto* fileStore = new Store();
+        bool success = parseRVMFile(fileStore, *file, 1, lazyFacetGroups, discard);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          file->store = fileStore;
+          file->success = success;
+          file->parsed = true;
+        }
+        parsed.notify_all();
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(size_t(threads), rvmFiles.size()); i++) {
+      workers.emplace_back(worker);
+    }
+
+    bool rv = true;
+    for (auto& file : files) {
+      if (file.isRVM) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          parsed.wait(lock, [&file] { return file.parsed; });
+        }
+        if (file.success) {
+          store->append(file.store);
+          fprintf(stderr, "Successfully parsed %s\n", file.path.c_str());
+        }
+        else {
+          fprintf(stderr, "Failed to parse %s: %s\n", file.path.c_str(), file.store->errorString());
+          rv = false;
+        }
+      }
+      else {
+        rv = parseAttFile(store, file, threads, discard);
+      }
+      if (!rv) {
+        abort = true;
+        break;
+      }
+    }
+
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    for (auto& file : files) {
+      delete file.store;
+      file.store = nullptr;
+    }
+    return rv;
+  }
+
+  bool parseInputFiles(Store* store, std::vector<InputFile>& files, unsigned threads, bool lazyFacetGroups, DiscardList* discard)
+  {
+    size_t rvmFiles = std::count_if(files.begin(), files.end(), [](const InputFile& file) { return file.isRVM; });
+
+    auto time0 = std::chrono::high_resolution_clock::now();
+    bool rv = (threads <= 1 || rvmFiles <= 1) ? parseInputFilesSerial(store, files, threads, lazyFacetGroups, discard) : parseInputFilesParallel(store, files, threads, lazyFacetGroups, discard);
+    if (rv && !files.empty()) {
+      long long e = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
+      logger(0, "Parsed %zu input files using %u threads (%lldms)", files.size(), threads, e);
+    }
+    return rv;
+  }
+
+  std::string indexPath(const std::string& rvmPath)
+  {
+    return rvmPath.substr(0, rvmPath.find_last_of('.')) + ".rvmidx";
+  }
+
+  // The att file among the inputs with the same stem as an rvm file, if any.
+  InputFile* findAttFile(std::vector<InputFile>& files, const InputFile& rvm)
+  {
+    auto stem = rvm.path.substr(0, rvm.path.find_last_of('.'));
+    for (auto& file : files) {
+      if (!file.isRVM && file.path.substr(0, file.path.find_last_of('.')) == stem) return &file;
+    }
+    return nullptr;
+  }
+
+  int64_t modifiedTime(const std::string& path)
+  {
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(path, ec);
+    return ec ? 0 : int64_t(time.time_since_epoch().count());
+  }
+
+  bool buildIndex(RVMIndex& index, const InputFile& rvm, const InputFile* att)
+  {
+    bool rv = processFile(rvm.path, [&index, att](const void* rvmPtr, size_t rvmSize)
+                          {
+                            if (att == nullptr) return buildRVMIndex(index, logger, rvmPtr, rvmSize, nullptr, 0);
+                            return processFile(att->path, [&](const void* attPtr, size_t attSize) { return buildRVMIndex(index, logger, rvmPtr, rvmSize, attPtr, attSize); });
+                          });
+    index.rvm.modified = modifiedTime(rvm.path);
+    if (att) index.att.modified = modifiedTime(att->path);
+    return rv;
+  }
+
+  // Check size and write time first, and only hash the file if they match.
+  bool matchesFile(const RVMIndexFingerprint& fingerprint, const std::string& path)
+  {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec || fingerprint.size != size || fingerprint.modified != modifiedTime(path)) return false;
+
+    uint64_t hash = 0;
+    return processFile(path, [&hash](const void* ptr, size_t size) { hash = rvmIndexHash(ptr, size); return true; }, false) && fingerprint.hash == hash;
+  }
+
+  bool writeIndexFiles(std::vector<InputFile>& files)
+  {
+    for (auto& file : files) {
+      if (!file.isRVM) continue;
+
+      auto time0 = std::chrono::high_resolution_clock::now();
+      auto path = indexPath(file.path);
+      RVMIndex index;
+      if (!buildIndex(index, file, findAttFile(files, file)) || !writeRVMIndex(index, logger, path.c_str())) {
+        logger(2, "Failed to build index %s", path.c_str());
+        return false;
+      }
+      long long e = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
+      logger(0, "Wrote %s with %zu groups (%lldms)", path.c_str(), index.entries.size(), e);
+    }
+    return true;
+  }
+
+  // Find the groups outside bbox using the index of each rvm file, or by scanning the file
+  // if the index is missing or stale, so that parsing can skip them.
+  bool applyBBoxFilter(std::vector<InputFile>& files, const BBox3f& bbox)
+  {
+    for (auto& file : files) {
+      if (!file.isRVM) continue;
+
+      auto * att = findAttFile(files, file);
+      auto path = indexPath(file.path);
+      RVMIndex index;
+      bool upToDate = readRVMIndex(index, logger, path.c_str())
+        && matchesFile(index.rvm, file.path)
+        && (att == nullptr || matchesFile(index.att, att->path));
+      if (!upToDate) {
+        logger(1, "No up-to-date index %s, scanning %s", path.c_str(), file.path.c_str());
+        if (!buildIndex(index, file, att)) return false;
+      }
+
+      std::vector<SkipRange> attSkip;
+      rvmIndexSkipRanges(file.skip, attSkip, index, bbox);
+      if (att && index.att.size) {
+        att->skip = std::move(attSkip);
+      }
+      logger(0, "Skipping %zu of %zu groups outside bounding box in %s", file.skip.size(), index.entries.size(), file.path.c_str());
+    }
+    return true;
+  }
+
   bool parseBool(Logger logger, const std::string& arg, const std::string& value)
   {
     std::string lower;
@@ -229,11 +439,21 @@ int main(int argc, char** argv)
   bool output_gltf_center = false;
   bool output_gltf_attributes = true;
   bool output_gltf_merge_geos = true;
+  bool output_gltf_share_seams = false;
   size_t output_gltf_split_level = 0;
 
   std::string output_rev;
   std::string output_obj_stem;
   std::string color_attribute;
+
+  unsigned threads = 1;
+  uint64_t triangleBudget = 0;
+  bool instancePrimitives = false;
+  bool lazyFacetGroups = false;
+  bool buildIndices = false;
+  bool bboxFilter = false;
+  BBox3f bbox;
+  std::vector<InputFile> inputFiles;
   
   Store* store = new Store();
 
@@ -250,6 +470,18 @@ int main(int argc, char** argv)
         groupBoundingBoxes = true;
         continue;
       }
+      else if (arg == "--lazy-facet-groups") {
+        lazyFacetGroups = true;
+        continue;
+      }
+      else if (arg == "--build-index") {
+        buildIndices = true;
+        continue;
+      }
+      else if (arg == "--instance-primitives") {
+        instancePrimitives = true;
+        continue;
+      }
 
       auto e = arg.find('=');
       if (e != std::string::npos) {
@@ -307,6 +539,10 @@ int main(int argc, char** argv)
           output_gltf_merge_geos = parseBool(logger, arg, val);
           continue;
         }
+        else if (key == "--output-gltf-share-seams") {
+          output_gltf_share_seams = parseBool(logger, arg, val);
+          continue;
+        }
         else if (key == "--output-gltf-split-level") {
           output_gltf_split_level = std::stoul(val);
           continue;
@@ -319,10 +555,30 @@ int main(int argc, char** argv)
           tolerance = std::max(1e-6f, std::stof(val));
           continue;
         }
+        else if (key == "--triangle-budget") {
+          triangleBudget = std::stoull(val);
+          continue;
+        }
         else if (key == "--cull-scale") {
           cullScale = std::stof(val); // set to negative to disable culling.
           continue;
         }
+        else if (key == "--threads") {
+          threads = std::stoul(val);
+          if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+          }
+          continue;
+        }
+        else if (key == "--bbox") {
+          float* b = bbox.data;
+          if (sscanf(val.c_str(), "%f,%f,%f,%f,%f,%f", b + 0, b + 1, b + 2, b + 3, b + 4, b + 5) != 6) {
+            logger(2, "Failed to parse bounding box '%s'", val.c_str());
+            return -1;
+          }
+          bboxFilter = true;
+          continue;
+        }
         else if (key == "--chunk-tiny") {
           chunkTinyVertexThreshold = std::stoul(val);
           should_tessellate = true;
@@ -338,48 +594,50 @@ int main(int argc, char** argv)
     auto arg_lc = arg;
     for (auto & c : arg_lc) c = static_cast<char>(std::tolower(c));
 
-    // parse rvm file
-    if (arg_lc.rfind(".rvm") != std::string::npos) {
-      if (processFile(arg, [store, arg](const void * ptr, size_t size) { return parseRVM(store, logger, arg.c_str(), ptr, size); }))
-      {
-        fprintf(stderr, "Successfully parsed %s\n", arg.c_str());
-      }
-      else {
-        fprintf(stderr, "Failed to parse %s: %s\n", arg.c_str(), store->errorString());
-        rv = -1;
-        break;
-      }
-      continue;
+    InputFile file;
+    file.path = arg;
+    file.isRVM = arg_lc.rfind(".rvm") != std::string::npos;
+    if (file.isRVM || arg_lc.rfind(".txt") != std::string::npos || arg_lc.rfind(".att")) {
+      inputFiles.push_back(file);
     }
+  }
 
-    // parse attributes file
-    if (arg_lc.rfind(".txt") != std::string::npos || arg_lc.rfind(".att")) {
-      if (processFile(arg, [store](const void* ptr, size_t size) { return parseAtt(store, logger, ptr, size); })) {
-        fprintf(stderr, "Successfully parsed %s\n", arg.c_str());
-      }
-      else {
-        fprintf(stderr, "Failed to parse %s\n", arg.c_str());
-        rv = -1;
-        break;
-      }
-      continue;
-    }
+  if (buildIndices) {
+    rv = writeIndexFiles(inputFiles) ? 0 : -1;
+    delete store;
+    return rv;
   }
 
-  if ((rv == 0) && should_colorize) {
-    Colorizer colorizer(logger, color_attribute.empty() ? nullptr : color_attribute.c_str());
-    store->apply(&colorizer);
+  if (bboxFilter && !applyBBoxFilter(inputFiles, bbox)) {
+    rv = -1;
   }
 
+  DiscardList discardList;
   if (rv == 0 && !discard_groups.empty()) {
-    if (processFile(discard_groups, [store](const void * ptr, size_t size) { return discardGroups(store, logger, ptr, size); })) {
+    if (processFile(discard_groups, [&discardList](const void * ptr, size_t size) { return readDiscardList(&discardList, logger, ptr, size); })) {
       logger(0, "Processed %s", discard_groups.c_str());
     }
     else {
       logger(2, "Failed to parse %s", discard_groups.c_str());
       rv = -1;
     }
-  } 
+  }
+
+  if (rv == 0) {
+    if (parseInputFiles(store, inputFiles, threads, lazyFacetGroups, discard_groups.empty() ? nullptr : &discardList)) {
+      if (!discard_groups.empty()) {
+        logger(0, "DiscardGroups: Discarded %u groups.", discardList.discarded.load());
+      }
+    }
+    else {
+      rv = -1;
+    }
+  }
+
+  if ((rv == 0) && should_colorize) {
+    Colorizer colorizer(logger, color_attribute.empty() ? nullptr : color_attribute.c_str());
+    store->apply(&colorizer);
+  }
 
   if (rv == 0 && !keep_regex.empty()) {
     unsigned prevGroups = store->groupCount_();
@@ -400,8 +658,8 @@ int main(int argc, char** argv)
   }
 
   if (rv == 0) {
-    connect(store, logger);
-    align(store, logger);
+    connect(store, logger, threads);
+    align(store, logger, threads);
   }
 
   if (rv == 0 && (should_tessellate || !output_json.empty())) {
@@ -410,12 +668,16 @@ int main(int argc, char** argv)
   }
 
   if (rv == 0 && should_tessellate ) {
-    float cullLeafThreshold = -1.f;
-    float cullGeometryThreshold = -1.f;
+    float cullLeafThreshold = cullScale;
+    float cullGeometryThreshold = cullScale;
     unsigned maxSamples = 100;
 
+    if (triangleBudget) {
+      tolerance = toleranceForTriangleBudget(store, logger, triangleBudget, cullScale, maxSamples);
+    }
+
     auto time0 = std::chrono::high_resolution_clock::now();
-    Tessellator tessellator(logger, tolerance, cullLeafThreshold, cullGeometryThreshold, maxSamples);
+    Tessellator tessellator(logger, tolerance, cullLeafThreshold, cullGeometryThreshold, maxSamples, threads, instancePrimitives);
     store->apply(&tessellator);
     auto time1 = std::chrono::high_resolution_clock::now();
     auto e0 = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
@@ -427,6 +689,20 @@ int main(int argc, char** argv)
            tolerance,
            (4*3*tessellator.vertices + 4*3*tessellator.triangles)/1024,
            e0);
+    logger(0, "Reused triangulations for %u of %u cached items (%.1f%%)",
+           tessellator.cacheHits,
+           tessellator.cacheLookups,
+           tessellator.cacheLookups ? (100.0 * tessellator.cacheHits) / tessellator.cacheLookups : 0.0);
+    if (instancePrimitives) {
+      logger(0, "Placed %u items as instances of %u unit primitives", tessellator.instanced, tessellator.unitPrimitives);
+    }
+    if (0.f < cullScale) {
+      logger(0, "Culled %u items smaller than %f, %u groups as a whole, saving about %llu triangles",
+             tessellator.geometryCulled,
+             cullScale * tolerance,
+             tessellator.leafCulled,
+             (unsigned long long)tessellator.culledTriangles);
+    }
   }
 
   bool do_flatten = false;
@@ -530,7 +806,8 @@ int main(int argc, char** argv)
                    output_gltf_rotate_z_to_y,
                    output_gltf_center,
                    output_gltf_attributes,
-                   output_gltf_merge_geos))
+                   output_gltf_merge_geos,
+                   output_gltf_share_seams))
     {
       long long e = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
       logger(0, "Exported gltf in %lldms", e);